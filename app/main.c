@@ -9,11 +9,163 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <getopt.h> 
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "../src/lab.h"
 
+#define SEARCH_RESULTS 64  // Matches Ctrl-R steps through
+
+static struct hist_match search_matches[SEARCH_RESULTS]; // Matches of the last Ctrl-R
+static size_t search_count = 0;                          // Number of matches
+static size_t search_pos = 0;                            // Match on the line
+
+static struct shell *shell = NULL; // The shell the line handler runs commands in
+static bool running = true;        // Cleared to leave the main loop
+static unsigned tmout_ms = 0;      // TMOUT in milliseconds, 0 for no timeout
+static int tmout_timer = -1;       // Timer that logs out an idle shell
+
+/**
+ * @brief Ctrl-R: replace the line with the best history match for it
+ *
+ * The first press searches for the text on the line, pressing it again
+ * steps to the next best match.
+ *
+ * @param count Numeric argument, unused
+ * @param key The key that was pressed, unused
+ * @return int 0
+ */
+static int search_history_key(int count, int key) {
+    UNUSED(count)
+    UNUSED(key)
+
+    if (rl_last_func != search_history_key) {
+        search_count = hist_search(rl_line_buffer, search_matches, SEARCH_RESULTS);
+        search_pos = 0;
+    } else {
+        search_pos++;
+    }
+    if (search_pos >= search_count) {
+        rl_ding();
+        return 0;
+    }
+
+    size_t len;
+    const char *entry = hist_get(search_matches[search_pos].n, &len);
+    char *line = entry ? strndup(entry, len) : NULL;
+    if (line) {
+        rl_replace_line(line, 0);
+        rl_point = rl_end;
+        free(line);
+    }
+    return 0;
+}
+
+/**
+ * @brief Run a line typed by the user
+ *
+ * @param line The line without its newline, NULL at end of input
+ */
+static void run_line(char *line) {
+    if (line == NULL) {
+        printf("\n");
+        rl_callback_handler_remove();
+        running = false;  // EOF (Ctrl+D) detected, exit the shell
+        return;
+    }
+
+    // Process non-empty lines
+    if (*line) {
+        // Replace !n with history entry n and show what will run
+        char *expanded = hist_expand(line);
+        if (expanded != NULL && strcmp(expanded, line) != 0) {
+            printf("%s\n", expanded);
+        }
+        free(line);
+        line = expanded;
+        if (line != NULL) {
+            // Add line to history, duplicates are dropped as HISTCONTROL says
+            size_t n = 0;
+            hist_add(line, &n);
+            if (hist_ring_add(line, n) != 0) add_history(line);
+            // Trim, parse and run the command
+            sh_eval(shell, line);
+        }
+    }
+    // Free the line buffer
+    free(line);
+    // Report background jobs before the next prompt
+    update_job_status();
+}
+
+/**
+ * @brief Run a line typed by the user, called by readline
+ *
+ * @param line The line without its newline, NULL at end of input
+ */
+static void handle_line(char *line) {
+    STATS_MEASURE(STAT_LINE, run_line(line));
+}
+
+/**
+ * @brief Log out a shell that waited TMOUT seconds for input
+ *
+ * @param arg Unused
+ */
+static void tmout_expired(void *arg) {
+    UNUSED(arg)
+    tmout_timer = -1;
+    rl_callback_handler_remove();
+    printf("\ntimed out waiting for input: auto-logout\n");
+    running = false;
+}
+
+/**
+ * @brief Start the TMOUT period over
+ */
+static void tmout_restart(void) {
+    if (tmout_ms == 0) return;
+    loop_timer_cancel(tmout_timer);
+    tmout_timer = loop_timer_add(tmout_ms, tmout_expired, NULL);
+}
+
+/**
+ * @brief Feed terminal input to readline
+ *
+ * @param fd Standard input
+ * @param arg Unused
+ */
+static void terminal_ready(int fd, void *arg) {
+    UNUSED(fd)
+    UNUSED(arg)
+    rl_callback_read_char();
+    if (running) tmout_restart();
+}
+
+/**
+ * @brief Report background jobs that finished while the user is typing
+ *
+ * The line being edited is cleared, the jobs are printed where it was and
+ * the prompt and line are drawn again below them.
+ *
+ * @param fd The job notification descriptor
+ * @param arg Unused
+ */
+static void jobs_ready(int fd, void *arg) {
+    UNUSED(fd)
+    UNUSED(arg)
+    if (!jobs_reaped_pending()) {
+        update_job_status();  // Only drains the notifications
+        return;
+    }
+    rl_clear_visible_line();
+    update_job_status();
+    fflush(stdout);
+    rl_on_new_line();
+    rl_redisplay();
+}
+
 /**
  * @brief Cleanup function to free resources used by readline and history
  * 
@@ -45,13 +197,21 @@ int main(int argc, char *argv[]) {
     struct shell sh = {0};  // Initialize shell structure
 
     // Parse arguments and exit if version was printed
-    if (parse_args(argc, argv)) {
+    if (parse_args(argc, argv, &sh)) {
         return 0;
     }
 
+    // Scripts, -c and piped input skip readline and history entirely
+    if (sh.batch) {
+        sh_init(&sh);
+        int status = sh.command ? sh_run_string(&sh, sh.command)
+                                : sh_run_script(&sh, sh.script);
+        sh_destroy(&sh);
+        return status;
+    }
+
     printf("Starting shell...\n");
 
-    char *line = NULL;
     // for custom prompt
     char *prompt = get_prompt("MY_PROMPT");
     
@@ -61,41 +221,52 @@ int main(int argc, char *argv[]) {
     rl_initialize();
     using_history();
 
-    // Main shell loop
-    while (1) {
-        // Check and update status of background jobs
-        update_job_status();  
-        // Get user input using readline
-        line = readline(prompt);
-        
-        if (line == NULL) {
-            printf("\n");
-            break;  // EOF (Ctrl+D) detected, exit the shell
+    // The session keeps the last HISTSIZE entries, the rest of the
+    // persistent history stays on disk until it is asked for
+    rl_bind_keyseq("\\C-r", search_history_key);
+    if (hist_ring_init_env() < 0) perror("shell");
+    size_t histsize = hist_ring_capacity();
+    if (histsize > 0) stifle_history(histsize > INT_MAX ? INT_MAX : (int)histsize);
+    if (histsize > 0 && hist_open(NULL) == 0) {
+        size_t count = hist_count();
+        size_t n = count > histsize ? count - histsize + 1 : 1;
+        for (; n <= count; n++) {
+            size_t len;
+            const char *entry = hist_get(n, &len);
+            char *copy = entry ? strndup(entry, len) : NULL;
+            if (copy) {
+                if (hist_ring_add(copy, n) != 0) add_history(copy);
+                free(copy);
+            }
         }
+    }
 
-        // Process non-empty lines
-        if (*line) {
-            // Add line to history
-            add_history(line);
-            // Trim whitespace from the input
-            char *trimmed_line = trim_white(line);
-            if (strlen(trimmed_line) > 0) {
-                // Parse the command line
-                char **args = cmd_parse(trimmed_line);
-                if (args) {
-                    if (!do_builtin(&sh, args)) {
-                        // Not a built-in command, execute it as an external command
-                        execute_command(args, &sh);
-                    }
-                    // Free the parsed command
-                    cmd_free(args);
-                }
-            }
+    // Terminal input, finished jobs and timers all arrive through the event
+    // loop, readline is fed one character at a time as input comes in
+    shell = &sh;
+    if (loop_init(LOOP_AUTO) < 0 || loop_watch(STDIN_FILENO, terminal_ready, NULL) < 0) {
+        perror("shell");
+        free(prompt);
+        sh_destroy(&sh);
+        return 1;
+    }
+    if (jobs_notify_fd() >= 0) loop_watch(jobs_notify_fd(), jobs_ready, NULL);
+    const char *tmout = getenv("TMOUT");
+    if (tmout != NULL && atoi(tmout) > 0) {
+        tmout_ms = (unsigned)atoi(tmout) * 1000u;
+        tmout_restart();
+    }
+    rl_callback_handler_install(prompt, handle_line);
+
+    // Main shell loop
+    while (running) {
+        if (loop_run_once() < 0) {
+            perror("shell");
+            rl_callback_handler_remove();
+            break;
         }
-        // Free the line buffer
-        free(line);
-        line = NULL;
     }
+    loop_destroy();
 
     printf("Exiting shell...\n");
     // Cleanup and exit
@@ -0,0 +1,109 @@
+/**
+ * @file bench-e2e.c
+ * @author Waylon Walsh
+ * @brief Commands per second of the whole shell reading commands from a
+ * pipe
+ * @date 2026-10-16
+ *
+ * A child runs the shell the way it runs with its standard input
+ * redirected from a pipe, and the benchmark writes the commands into the
+ * other end. The time covers reading, parsing and running every line up
+ * to the exit of the shell, so it shows what a change to any layer does
+ * to the commands a script gets through.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "../src/lab.h"
+
+#define BUILTIN_LINES 200000 // Lines run by the builtin measurements
+#define SPAWN_LINES 2000     // Lines run by the measurements that start processes
+
+/**
+ * @brief Run the shell on its standard input and exit with its status
+ *
+ * @param input Read end of the pipe the commands come from
+ */
+static void run_shell(int input) {
+    int null = open("/dev/null", O_WRONLY);
+    if (dup2(input, STDIN_FILENO) < 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0) {
+        perror("bench-e2e");
+        _exit(EXIT_FAILURE);
+    }
+    close(input);
+    close(null);
+
+    struct shell sh = { .batch = true };
+    sh_init(&sh);
+    int status = sh_run_script(&sh, NULL);
+    sh_destroy(&sh);
+    _exit(status);
+}
+
+/**
+ * @brief Pipe the same line to a shell many times and report commands/s
+ *
+ * @param name Name used in the report
+ * @param line The command, without a newline
+ * @param count Number of times it is run
+ */
+static void bench_e2e(const char *name, const char *line, int count) {
+    size_t len = strlen(line);
+    size_t size = (len + 1) * (size_t)count;
+    char *input = malloc(size);
+    for (int i = 0; i < count; i++) {
+        memcpy(input + (len + 1) * (size_t)i, line, len);
+        input[(len + 1) * (size_t)i + len] = '\n';
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+
+    double start = bench_now_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        run_shell(fds[0]);
+    }
+    close(fds[0]);
+    for (size_t done = 0; done < size;) {
+        ssize_t n = write(fds[1], input + done, size - done);
+        if (n < 0) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        done += (size_t)n;
+    }
+    close(fds[1]);
+    int status;
+    waitpid(pid, &status, 0);
+    double elapsed = bench_now_ns() - start;
+    free(input);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: shell failed running %s\n", name, line);
+        exit(EXIT_FAILURE);
+    }
+    bench_report(name, count / (elapsed / 1e9), "commands/s");
+}
+
+int main(void) {
+    bench_e2e("e2e.builtin", "cd .", BUILTIN_LINES);
+    bench_e2e("e2e.builtin_output", "pwd", BUILTIN_LINES);
+    bench_e2e("e2e.external", "/bin/true", SPAWN_LINES);
+    bench_e2e("e2e.external_path", "true", SPAWN_LINES);
+    bench_e2e("e2e.pipeline", "true | true", SPAWN_LINES / 2);
+    return 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file bench-jobs.c
+ * @author Waylon Walsh
+ * @brief Cost of the job table operations as the table grows from 10 to
+ * 10000 jobs
+ * @date 2026-10-16
+ *
+ * The jobs are never started, their pids lie above the largest pid the
+ * kernel hands out, so pidfd_open fails with ESRCH and no process is ever
+ * reaped. That keeps the numbers about the table itself: add and remove
+ * should stay flat as the table grows, update_job_status should not depend
+ * on the number of running jobs at all, and listing the jobs is linear.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include "bench.h"
+#include "../src/lab.h"
+
+#define FAKE_PID_BASE 5000000 // Above PID_MAX_LIMIT, never a real process
+#define TARGET_OPS 200000     // Operations per measurement, spread over rounds
+#define UPDATE_CALLS 100000   // update_job_status calls per measurement
+#define PRINT_JOBS 200000     // Jobs listed per measurement
+
+/**
+ * @brief Fill the job table with fake background jobs
+ *
+ * @param ids Receives the job IDs
+ * @param n Number of jobs
+ * @param base First pid to use
+ */
+static void add_jobs(int *ids, int n, int base) {
+    for (int i = 0; i < n; i++) {
+        ids[i] = add_job(base + i, "sleep 1000", true);
+        if (ids[i] < 0) {
+            fprintf(stderr, "add_job failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * @brief Measure the job table operations with n jobs in it
+ *
+ * @param n Number of jobs
+ * @param out Stream the job listings go to
+ */
+static void bench_jobs(int n, FILE *out) {
+    int *ids = malloc((size_t)n * sizeof(int));
+    int rounds = TARGET_OPS / n > 0 ? TARGET_OPS / n : 1;
+    char name[64];
+
+    // Fill and empty the table, the first round also grows it
+    double add_ns = 0, remove_ns = 0;
+    for (int r = 0; r < rounds; r++) {
+        double start = bench_now_ns();
+        add_jobs(ids, n, FAKE_PID_BASE);
+        add_ns += bench_now_ns() - start;
+
+        start = bench_now_ns();
+        for (int i = 0; i < n; i++) remove_job(ids[i]);
+        remove_ns += bench_now_ns() - start;
+    }
+    snprintf(name, sizeof(name), "jobs.add.n%d", n);
+    bench_report(name, (double)rounds * n / (add_ns / 1e9), "ops/s");
+    snprintf(name, sizeof(name), "jobs.remove.n%d", n);
+    bench_report(name, (double)rounds * n / (remove_ns / 1e9), "ops/s");
+
+    // Keep the table full and replace one job at a time
+    add_jobs(ids, n, FAKE_PID_BASE);
+    int churn = rounds * n;
+    double start = bench_now_ns();
+    for (int i = 0; i < churn; i++) {
+        int k = i % n;
+        remove_job(ids[k]);
+        ids[k] = add_job(FAKE_PID_BASE + n + k, "sleep 1000", true);
+    }
+    double elapsed = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "jobs.churn.n%d", n);
+    bench_report(name, churn / (elapsed / 1e9), "ops/s");
+
+    start = bench_now_ns();
+    for (int i = 0; i < UPDATE_CALLS; i++) update_job_status();
+    elapsed = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "jobs.update.n%d", n);
+    bench_report(name, UPDATE_CALLS / (elapsed / 1e9), "calls/s");
+
+    int listings = PRINT_JOBS / n > 0 ? PRINT_JOBS / n : 1;
+    start = bench_now_ns();
+    for (int i = 0; i < listings; i++) print_jobs(out);
+    elapsed = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "jobs.print.n%d", n);
+    bench_report(name, (double)listings * n / (elapsed / 1e9), "jobs/s");
+
+    for (int i = 0; i < n; i++) remove_job(ids[i]);
+    free(ids);
+}
+
+int main(void) {
+    FILE *out = fopen("/dev/null", "w");
+    if (!out) {
+        perror("/dev/null");
+        return EXIT_FAILURE;
+    }
+    initialize_jobs();
+
+    bench_jobs(10, out);
+    bench_jobs(100, out);
+    bench_jobs(1000, out);
+    bench_jobs(10000, out);
+
+    destroy_jobs();
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file bench-parallel.c
+ * @author Waylon Walsh
+ * @brief Throughput of the parallel builtin at several job limits
+ * @date 2026-10-16
+ *
+ * Short commands show the cost of starting and reaping a job, commands
+ * that sleep show how well the scheduler keeps every slot busy.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include "bench.h"
+#include "../src/lab.h"
+
+#define DEFAULT_JOBS 1000 // Commands run per measurement
+#define SLEEP_JOBS 64     // Commands run per sleep measurement
+
+/**
+ * @brief Run a command for every input with parallel and report jobs/s
+ *
+ * @param sh The shell
+ * @param name Name used in the report
+ * @param max_jobs Value of -j
+ * @param cmd The command, NULL terminated
+ * @param input The input passed to every job
+ * @param count Number of jobs
+ */
+static void bench_parallel(struct shell *sh, const char *name, int max_jobs,
+                           char **cmd, char *input, int count) {
+    int argc = 0;
+    while (cmd[argc] != NULL) argc++;
+    char **argv = malloc((size_t)(argc + count + 5) * sizeof(char *));
+    char jobs[16];
+    snprintf(jobs, sizeof(jobs), "%d", max_jobs);
+
+    int n = 0;
+    argv[n++] = "parallel";
+    argv[n++] = "-j";
+    argv[n++] = jobs;
+    for (int i = 0; i < argc; i++) argv[n++] = cmd[i];
+    argv[n++] = ":::";
+    for (int i = 0; i < count; i++) argv[n++] = input;
+    argv[n] = NULL;
+
+    int status;
+    double start = bench_now_ns();
+    builtin_run(sh, argv, stdout, &status);
+    double elapsed = bench_now_ns() - start;
+    arena_reset(&sh->arena);
+    free(argv);
+    if (status != 0) {
+        fprintf(stderr, "%s: %d jobs failed\n", name, status);
+        exit(EXIT_FAILURE);
+    }
+    bench_report(name, count / (elapsed / 1e9), "jobs/s");
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_JOBS;
+    struct shell sh = { .batch = true };
+    initialize_jobs();
+
+    char *true_cmd[] = { "/bin/true", NULL };
+    bench_parallel(&sh, "parallel.true.j1", 1, true_cmd, "x", count);
+    bench_parallel(&sh, "parallel.true.j4", 4, true_cmd, "x", count);
+    bench_parallel(&sh, "parallel.true.j64", 64, true_cmd, "x", count);
+
+    char *sleep_cmd[] = { "/bin/sleep", NULL };
+    bench_parallel(&sh, "parallel.sleep10ms.j1", 1, sleep_cmd, "0.01", SLEEP_JOBS);
+    bench_parallel(&sh, "parallel.sleep10ms.j16", 16, sleep_cmd, "0.01", SLEEP_JOBS);
+
+    arena_destroy(&sh.arena);
+    destroy_jobs();
+    return 0;
+}
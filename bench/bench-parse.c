@@ -0,0 +1,118 @@
+/**
+ * @file bench-parse.c
+ * @author Waylon Walsh
+ * @brief Throughput of cmd_parse and trim_white over lines of different
+ * shapes, from short commands to very long argument lists
+ * @date 2026-10-16
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../src/lab.h"
+
+/**
+ * @brief Build a line with the given number of arguments
+ *
+ * @param args Number of arguments after the command name
+ * @return char* Newly allocated command line
+ */
+static char *make_line(int args) {
+    size_t size = 16 + (size_t)args * 16;
+    char *line = malloc(size);
+    size_t len = (size_t)snprintf(line, size, "echo");
+    for (int i = 0; i < args; i++) {
+        len += (size_t)snprintf(line + len, size - len, " file-%06d.txt", i);
+    }
+    return line;
+}
+
+/**
+ * @brief Parse a line repeatedly and report lines/s and MB/s
+ *
+ * @param name Name used in the report
+ * @param line The line to parse
+ * @param iterations Number of parses
+ */
+static void bench_parse(const char *name, const char *line, int iterations) {
+    size_t len = strlen(line);
+    char report[64];
+
+    double start = bench_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        char **argv = cmd_parse(line);
+        cmd_free(argv);
+    }
+    double elapsed = (bench_now_ns() - start) / 1e9;
+
+    snprintf(report, sizeof(report), "%s.rate", name);
+    bench_report(report, iterations / elapsed, "lines/s");
+    snprintf(report, sizeof(report), "%s.throughput", name);
+    bench_report(report, (double)len * iterations / elapsed / 1e6, "MB/s");
+}
+
+/**
+ * @brief Trim a line repeatedly and report lines/s and MB/s
+ *
+ * trim_white works in place, so every iteration first copies the line
+ * into a scratch buffer. The copy is part of the measurement.
+ *
+ * @param name Name used in the report
+ * @param line The line to trim
+ * @param iterations Number of trims
+ */
+static void bench_trim(const char *name, const char *line, int iterations) {
+    size_t len = strlen(line);
+    char *scratch = malloc(len + 1);
+    char report[64];
+    size_t kept = 0;
+
+    double start = bench_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        memcpy(scratch, line, len + 1);
+        kept += strlen(trim_white(scratch));
+    }
+    double elapsed = (bench_now_ns() - start) / 1e9;
+    free(scratch);
+    if (kept == 0) abort();  // Keep the trims from being optimized away
+
+    snprintf(report, sizeof(report), "%s.rate", name);
+    bench_report(report, iterations / elapsed, "lines/s");
+    snprintf(report, sizeof(report), "%s.throughput", name);
+    bench_report(report, (double)len * iterations / elapsed / 1e6, "MB/s");
+}
+
+/**
+ * @brief Build a short command with long runs of blanks around it
+ *
+ * @param pad Number of blanks on each side
+ * @return char* Newly allocated line
+ */
+static char *make_padded(size_t pad) {
+    char *line = malloc(2 * pad + 8);
+    memset(line, ' ', pad);
+    memcpy(line + pad, "ls -l", 5);
+    memset(line + pad + 5, '\t', pad);
+    line[2 * pad + 5] = '\0';
+    return line;
+}
+
+int main(void) {
+    char *long_line = make_line(10000);
+    char *long_padding = make_padded(4096);
+
+    bench_parse("parse.short", "ls -a -l", 1000000);
+    bench_parse("parse.padded", "   grep   -rn   pattern   src   ", 1000000);
+    bench_parse("parse.tabs", "\tmake\t-j\t8\tall\t", 1000000);
+    bench_parse("parse.pipeline", "cat access.log | grep -v health | sort | uniq -c | sort -rn", 1000000);
+    bench_parse("parse.redirects", "sort -u < in.txt > out.txt 2>> err.log", 1000000);
+    bench_parse("parse.10k_args", long_line, 500);
+
+    bench_trim("trim.none", "ls -a -l", 1000000);
+    bench_trim("trim.short_pad", "   ls -a -l   ", 1000000);
+    bench_trim("trim.long_pad", long_padding, 100000);
+    bench_trim("trim.10k_args", long_line, 5000);
+
+    free(long_padding);
+    free(long_line);
+    return 0;
+}
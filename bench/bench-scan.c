@@ -0,0 +1,93 @@
+/**
+ * @file bench-scan.c
+ * @author Waylon Walsh
+ * @brief Bytes per cycle of cmd_parse and trim_white for each scan
+ * implementation
+ * @date 2026-10-16
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../src/lab.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles() ((double)__rdtsc())
+#define CYCLE_UNIT "bytes/cycle"
+#else
+#define bench_cycles() bench_now_ns()
+#define CYCLE_UNIT "bytes/ns"
+#endif
+
+#define LINE_SIZE (512 * 1024)
+
+/**
+ * @brief Build a long generated file list like the ones our jobs produce
+ *
+ * @return char* Newly allocated line of about LINE_SIZE bytes
+ */
+static char *make_file_list(void) {
+    char *line = malloc(LINE_SIZE + 64);
+    size_t len = (size_t)snprintf(line, LINE_SIZE, "tar -cf out.tar");
+    for (int i = 0; len < LINE_SIZE - 64; i++) {
+        len += (size_t)snprintf(line + len, 64, " src/module-%d/file-%d.c", i % 97, i);
+    }
+    return line;
+}
+
+/**
+ * @brief Build a line with long runs of padding on both ends
+ *
+ * @return char* Newly allocated line of LINE_SIZE bytes
+ */
+static char *make_padded(void) {
+    char *line = malloc(LINE_SIZE + 1);
+    memset(line, ' ', LINE_SIZE);
+    memcpy(line + LINE_SIZE / 2, "ls", 2);
+    line[LINE_SIZE] = '\0';
+    return line;
+}
+
+int main(void) {
+    static const struct {
+        enum scan_impl impl;
+        const char *name;
+    } impls[] = {
+        { SCAN_IMPL_SCALAR, "scalar" },
+        { SCAN_IMPL_SSE2, "sse2" },
+        { SCAN_IMPL_AVX2, "avx2" },
+    };
+    char *list = make_file_list();
+    char *padded = make_padded();
+    char *copy = malloc(LINE_SIZE + 1);
+    size_t list_len = strlen(list);
+    const int iterations = 200;
+    char name[64];
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (scan_set_impl(impls[i].impl) != 0) continue;
+
+        double start = bench_cycles();
+        for (int n = 0; n < iterations; n++) {
+            cmd_free(cmd_parse(list));
+        }
+        double cycles = bench_cycles() - start;
+        snprintf(name, sizeof(name), "scan.cmd_parse.%s", impls[i].name);
+        bench_report(name, (double)list_len * iterations / cycles, CYCLE_UNIT);
+
+        cycles = 0;
+        for (int n = 0; n < iterations; n++) {
+            memcpy(copy, padded, LINE_SIZE + 1);
+            start = bench_cycles();
+            trim_white(copy);
+            cycles += bench_cycles() - start;
+        }
+        snprintf(name, sizeof(name), "scan.trim_white.%s", impls[i].name);
+        bench_report(name, (double)LINE_SIZE * iterations / cycles, CYCLE_UNIT);
+    }
+
+    free(copy);
+    free(padded);
+    free(list);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file bench-spawn.c
+ * @author Waylon Walsh
+ * @brief Compare fork + exec against posix_spawn for short lived children,
+ * and measure the whole path of a command through execute_command
+ * @date 2026-10-16
+ */
+#include <stdlib.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "../src/lab.h"
+
+#define DEFAULT_ITERATIONS 2000
+
+/**
+ * @brief Start and reap /bin/true repeatedly with the given spawn mode
+ *
+ * @param name Name used in the report
+ * @param mode Spawn strategy to measure
+ * @param iterations Number of children to start
+ */
+static void bench_spawn(const char *name, enum spawn_mode mode, int iterations) {
+    char *argv[] = { "/bin/true", NULL };
+    struct spawn_opts opts = { .pgid = -1, .terminal = -1 };
+
+    set_spawn_mode(mode);
+    double start = bench_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid = spawn_command(argv, &opts);
+        if (pid < 0) {
+            perror("spawn_command");
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    double elapsed = bench_now_ns() - start;
+    bench_report(name, iterations / (elapsed / 1e9), "spawns/s");
+}
+
+/**
+ * @brief Run a command through execute_command repeatedly
+ *
+ * Each run parses the line, starts the process, tracks it in the job
+ * table and waits for it, as a command typed at the prompt does.
+ *
+ * @param name Name used in the report
+ * @param line The command line
+ * @param iterations Number of runs
+ */
+static void bench_execute(const char *name, const char *line, int iterations) {
+    struct shell sh = { .batch = true };
+    initialize_jobs();
+    set_spawn_mode(SPAWN_AUTO);
+
+    double start = bench_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        if (execute_command(cmd_parse_arena(&sh.arena, line), &sh) != 0) {
+            fprintf(stderr, "%s: %s failed\n", name, line);
+            exit(EXIT_FAILURE);
+        }
+        arena_reset(&sh.arena);
+    }
+    double elapsed = bench_now_ns() - start;
+    bench_report(name, iterations / (elapsed / 1e9), "spawns/s");
+
+    arena_destroy(&sh.arena);
+    destroy_jobs();
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+    // Grow the heap a bit so the page table copy made by fork is visible
+    size_t ballast_size = 64 * 1024 * 1024;
+    char *ballast = malloc(ballast_size);
+    for (size_t i = 0; ballast && i < ballast_size; i += 4096) ballast[i] = 1;
+
+    bench_spawn("spawn.fork", SPAWN_FORK, iterations);
+    bench_spawn("spawn.posix_spawn", SPAWN_AUTO, iterations);
+    bench_execute("spawn.execute_command", "/bin/true", iterations);
+    bench_execute("spawn.execute_command_path", "true", iterations);
+    bench_execute("spawn.execute_command_pipe", "true | true", iterations / 2);
+
+    free(ballast);
+    return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file bench.h
+ * @author Waylon Walsh
+ * @brief Small helpers shared by the benchmark programs
+ * @date 2026-10-16
+ *
+ * Every benchmark prints one line per measurement in the form
+ *
+ *     <name> <value> <unit>
+ *
+ * so that results from two revisions can be compared with diff or join.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @brief Read the monotonic clock in nanoseconds
+ *
+ * @return double Current time in nanoseconds
+ */
+static inline double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Print a single result line
+ *
+ * @param name Name of the measurement
+ * @param value Measured value
+ * @param unit Unit of the value
+ */
+static inline void bench_report(const char *name, double value, const char *unit) {
+    printf("%-40s %16.2f %s\n", name, value, unit);
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @file arena.c
+ * @author Waylon Walsh
+ * @brief Bump allocator for memory that lives for a single command
+ * @date 2026-10-16
+ *
+ * Everything the shell builds while handling one input line (the parsed
+ * arguments, the background job description, later parser stages) is
+ * carved out of an arena and released in one step by arena_reset once the
+ * line is done. Chunks are kept across resets, so after the first few
+ * commands the main loop no longer touches the heap for this state. Only
+ * default sized chunks up to ARENA_KEEP_SIZE are kept. The oversized
+ * chunks of one huge line or parallel input list go back to the system at
+ * the next reset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024) // Default size of a chunk
+#define ARENA_ALIGN 16               // Alignment of every allocation
+#define ARENA_KEEP_SIZE (4 * ARENA_CHUNK_SIZE) // Most bytes kept across a reset
+
+/**
+ * @brief A block of memory allocations are carved from
+ */
+struct arena_chunk {
+    struct arena_chunk *next; // Next chunk in the arena
+    size_t size;              // Usable bytes in data
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+/**
+ * @brief Allocate a new chunk
+ *
+ * @param size Minimum number of usable bytes
+ * @return struct arena_chunk* The chunk, the process exits if out of memory
+ */
+static struct arena_chunk *arena_new_chunk(size_t size) {
+    if (size < ARENA_CHUNK_SIZE) size = ARENA_CHUNK_SIZE;
+
+    struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + size);
+    if (!chunk) {
+        fprintf(stderr, "allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+/**
+ * @brief Initialize an empty arena
+ *
+ * @param a The arena
+ */
+void arena_init(struct arena *a) {
+    a->head = NULL;
+    a->current = NULL;
+    a->used = 0;
+}
+
+/**
+ * @brief Allocate memory from the arena
+ *
+ * @param a The arena
+ * @param size Number of bytes
+ * @return void* Memory aligned to ARENA_ALIGN bytes
+ */
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (a->current == NULL) {
+        if (a->head == NULL) {
+            a->head = arena_new_chunk(size);
+        }
+        a->current = a->head;
+        a->used = 0;
+    }
+
+    while (a->current->size - a->used < size) {
+        struct arena_chunk *next = a->current->next;
+        if (next == NULL || next->size < size) {
+            // Insert a fresh chunk, any smaller one after it is still reused
+            struct arena_chunk *chunk = arena_new_chunk(size);
+            chunk->next = next;
+            a->current->next = chunk;
+            next = chunk;
+        }
+        a->current = next;
+        a->used = 0;
+    }
+
+    void *ptr = a->current->data + a->used;
+    a->used += size;
+    return ptr;
+}
+
+/**
+ * @brief Copy a string into the arena
+ *
+ * @param a The arena
+ * @param s The string to copy
+ * @return char* The copy
+ */
+char *arena_strdup(struct arena *a, const char *s) {
+    size_t len = strlen(s) + 1;
+    return memcpy(arena_alloc(a, len), s, len);
+}
+
+/**
+ * @brief Release every allocation at once, keeping a few chunks for reuse
+ *
+ * @param a The arena
+ */
+void arena_reset(struct arena *a) {
+    struct arena_chunk **link = &a->head;
+    size_t kept = 0;
+    while (*link != NULL) {
+        struct arena_chunk *chunk = *link;
+        if (chunk->size == ARENA_CHUNK_SIZE && kept < ARENA_KEEP_SIZE) {
+            kept += chunk->size;
+            link = &chunk->next;
+        } else {
+            *link = chunk->next;
+            free(chunk);
+        }
+    }
+    a->current = a->head;
+    a->used = 0;
+}
+
+/**
+ * @brief Number of bytes the arena holds in its chunks
+ *
+ * @param a The arena
+ * @return size_t Usable bytes of all chunks, in use or not
+ */
+size_t arena_reserved(const struct arena *a) {
+    size_t total = 0;
+    for (const struct arena_chunk *chunk = a->head; chunk; chunk = chunk->next) {
+        total += chunk->size;
+    }
+    return total;
+}
+
+/**
+ * @brief Free every chunk owned by the arena
+ *
+ * @param a The arena
+ */
+void arena_destroy(struct arena *a) {
+    struct arena_chunk *chunk = a->head;
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(a);
+}
@@ -0,0 +1,248 @@
+/**
+ * @file batch.c
+ * @author Waylon Walsh
+ * @brief Running commands from a script, a string or a pipe
+ * @date 2026-10-16
+ *
+ * Without a user at the terminal readline only costs time: it sets up the
+ * terminal, keeps history and copies every line. In batch mode input is
+ * read in large blocks and split into lines in place, and each line goes
+ * through sh_eval like an interactive one.
+ *
+ * A script that is a regular file, given by name or redirected to
+ * standard input, is mapped instead of read. Lines are
+ * found one at a time as they are run and parsed straight out of the
+ * mapping, so starting a script costs the same whatever its size. The
+ * script must not be truncated while it runs. When the script is standard
+ * input the offset of the descriptor is kept at the end of the line being
+ * run, and the next line is taken from wherever the command left it, so
+ * a command that reads standard input gets the rest of the script, as in
+ * other shells.
+ *
+ * The reader of pipes buffers ahead, so commands run from a pipe do not
+ * share the script's standard input with the shell.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lab.h"
+
+#define LINE_READER_SIZE (1024 * 1024) // Initial size of the read buffer
+
+/**
+ * @brief Initialize a line reader
+ *
+ * @param r The reader
+ * @param fd Descriptor to read from, not closed by the reader
+ * @return int 0 on success, -1 if memory could not be allocated
+ */
+int line_reader_init(struct line_reader *r, int fd) {
+    r->buf = malloc(LINE_READER_SIZE);
+    if (!r->buf) return -1;
+    r->fd = fd;
+    r->size = LINE_READER_SIZE;
+    r->start = 0;
+    r->end = 0;
+    r->eof = false;
+    return 0;
+}
+
+/**
+ * @brief Read more input, moving the unread part to the front first
+ *
+ * @param r The reader
+ * @return ssize_t Number of bytes read, 0 at end of input, -1 on error
+ */
+static ssize_t line_reader_fill(struct line_reader *r) {
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->end + 1 >= r->size) {
+        // A single line longer than the buffer
+        char *buf = realloc(r->buf, r->size * 2);
+        if (!buf) {
+            errno = ENOMEM;
+            return -1;
+        }
+        r->buf = buf;
+        r->size *= 2;
+    }
+
+    ssize_t n;
+    do {
+        // Keep a byte free for the terminator of a last line without newline
+        n = read(r->fd, r->buf + r->end, r->size - r->end - 1);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) r->end += (size_t)n;
+    return n;
+}
+
+/**
+ * @brief Return the next line of input
+ *
+ * @param r The reader
+ * @return char* The line without its newline, valid until the next call,
+ * or NULL at the end of the input or on error
+ */
+char *line_reader_next(struct line_reader *r) {
+    size_t scanned = r->start;
+    for (;;) {
+        char *nl = memchr(r->buf + scanned, '\n', r->end - scanned);
+        if (nl != NULL) {
+            char *line = r->buf + r->start;
+            *nl = '\0';
+            r->start = (size_t)(nl - r->buf) + 1;
+            return line;
+        }
+        if (r->eof) break;
+
+        size_t offset = scanned - r->start;
+        ssize_t n = line_reader_fill(r);
+        if (n < 0) {
+            perror("shell");
+            r->eof = true;
+        } else if (n == 0) {
+            r->eof = true;
+        }
+        scanned = r->start + offset;
+    }
+
+    if (r->start == r->end) return NULL;
+    // Last line without a trailing newline
+    char *line = r->buf + r->start;
+    r->buf[r->end] = '\0';
+    r->start = r->end;
+    return line;
+}
+
+/**
+ * @brief Release the buffer of a line reader
+ *
+ * @param r The reader
+ */
+void line_reader_destroy(struct line_reader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/**
+ * @brief Run every line read from a descriptor
+ *
+ * @param sh Pointer to the shell structure
+ * @param fd The descriptor
+ * @return int Status of the last command
+ */
+static int sh_run_fd(struct shell *sh, int fd) {
+    struct line_reader r;
+    if (line_reader_init(&r, fd) < 0) {
+        fprintf(stderr, "allocation error\n");
+        return 1;
+    }
+
+    int status = 0;
+    char *line;
+    while ((line = line_reader_next(&r)) != NULL) {
+        STATS_MEASURE(STAT_LINE, status = sh_eval(sh, line));
+    }
+    line_reader_destroy(&r);
+    return status;
+}
+
+/**
+ * @brief Run every line of a buffer
+ *
+ * @param sh Pointer to the shell structure
+ * @param p First line to run
+ * @param end End of the buffer
+ * @param base Start of the buffer, offset 0 of seek_fd
+ * @param seek_fd Descriptor whose offset follows the lines that are run,
+ * -1 for none
+ * @return int Status of the last command
+ */
+static int sh_run_buffer(struct shell *sh, const char *p, const char *end,
+                         const char *base, int seek_fd) {
+    int status = 0;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        const char *next = nl ? nl + 1 : end;
+        if (seek_fd >= 0) lseek(seek_fd, next - base, SEEK_SET);
+
+        STATS_MEASURE(STAT_LINE, status = sh_eval_view(sh, p, len));
+
+        // The command may have read some of the script
+        off_t offset = seek_fd >= 0 ? lseek(seek_fd, 0, SEEK_CUR) : -1;
+        p = offset >= 0 && offset <= end - base ? base + offset : next;
+    }
+    return status;
+}
+
+/**
+ * @brief Run a script by mapping it
+ *
+ * @param sh Pointer to the shell structure
+ * @param fd Descriptor of the script
+ * @param size Size of the script
+ * @param shared The descriptor is standard input and shared with the
+ * commands, the script starts at its offset
+ * @return int Status of the last command, -1 if the script can't be mapped
+ */
+static int sh_run_mapped(struct shell *sh, int fd, size_t size, bool shared) {
+    off_t start = shared ? lseek(fd, 0, SEEK_CUR) : 0;
+    if (start < 0) return -1;
+    if ((size_t)start >= size) return 0;
+
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    int status = sh_run_buffer(sh, map + start, map + size, map, shared ? fd : -1);
+    munmap(map, size);
+    return status;
+}
+
+/**
+ * @brief Run the commands in a script
+ *
+ * @param sh Pointer to the shell structure
+ * @param path Path of the script, NULL for standard input
+ * @return int Status of the last command, 127 if the script can't be opened
+ */
+int sh_run_script(struct shell *sh, const char *path) {
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+    if (fd < 0) {
+        fprintf(stderr, "shell: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    struct stat st;
+    int status = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        status = sh_run_mapped(sh, fd, (size_t)st.st_size, path == NULL);
+    }
+    if (status < 0) {
+        // Pipes, devices and files that can't be mapped are read instead
+        status = sh_run_fd(sh, fd);
+    }
+    if (path != NULL) close(fd);
+    return status;
+}
+
+/**
+ * @brief Run the commands in a string, one per line
+ *
+ * @param sh Pointer to the shell structure
+ * @param commands The commands
+ * @return int Status of the last command
+ */
+int sh_run_string(struct shell *sh, const char *commands) {
+    return sh_run_buffer(sh, commands, commands + strlen(commands), commands, -1);
+}
@@ -0,0 +1,356 @@
+/**
+ * @file builtin.c
+ * @author Waylon Walsh
+ * @brief Commands the shell runs itself
+ * @date 2026-10-16
+ *
+ * Every builtin is described by one entry of the builtins table, so adding
+ * a builtin means writing its function and adding a line there. Commands
+ * are looked up through a perfect hash of the names: the first lookup
+ * searches for a hash seed under which no two names share a slot of
+ * builtin_slots, after which finding out whether a word is a builtin
+ * costs one hash and at most one strcmp. External commands, which are
+ * not builtins, no longer pay for a compare against every name. The
+ * search gives up after BUILTIN_MAX_SEEDS seeds and aborts the shell, and
+ * test_builtin_lookup looks up every entry, so a table that cannot be
+ * hashed fails make check instead of hanging the first command.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include "lab.h"
+
+#define HISTORY_SEARCH_RESULTS 20 // Matches printed by history -s
+#define BUILTIN_SLOTS 64          // Power of two, a few times the builtins
+#define BUILTIN_MAX_SEEDS 65536   // Seeds tried before giving up
+
+/**
+ * @brief Run the exit builtin
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int Does not return
+ */
+static int builtin_exit(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(argv)
+    UNUSED(out)
+    sh_destroy(sh);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Run the cd builtin
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int 0 on success, 1 on failure
+ */
+static int builtin_cd(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(sh)
+    UNUSED(out)
+    return change_dir(argv) == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Run the history builtin
+ *
+ * With no arguments the whole history is printed, history -s PATTERN
+ * prints the best matches for the rest of the line.
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int 0 on success, 1 on failure
+ */
+static int builtin_history(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(sh)
+    if (argv[1] == NULL) {
+        print_history(out);
+        return 0;
+    }
+    if (strcmp(argv[1], "-s") != 0 || argv[2] == NULL) {
+        fprintf(stderr, "history: usage: history [-s pattern]\n");
+        return 1;
+    }
+
+    // The pattern is the rest of the line, so it can contain spaces
+    size_t size = 1;
+    for (int i = 2; argv[i] != NULL; i++) size += strlen(argv[i]) + 1;
+    char *pattern = malloc(size);
+    if (!pattern) return 1;
+    pattern[0] = '\0';
+    for (int i = 2; argv[i] != NULL; i++) {
+        if (i > 2) strcat(pattern, " ");
+        strcat(pattern, argv[i]);
+    }
+
+    struct hist_match matches[HISTORY_SEARCH_RESULTS];
+    size_t count = hist_search(pattern, matches, HISTORY_SEARCH_RESULTS);
+    for (size_t i = 0; i < count; i++) {
+        size_t len;
+        const char *entry = hist_get(matches[i].n, &len);
+        if (entry) fprintf(out, "%zu: %.*s\n", matches[i].n, (int)len, entry);
+    }
+    free(pattern);
+    return 0;
+}
+
+/**
+ * @brief Run the pwd builtin
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int 0 on success, 1 on failure
+ */
+static int builtin_pwd(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(sh)
+    UNUSED(argv)
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("getcwd() error");
+        return 1;
+    }
+    fprintf(out, "%s\n", cwd);
+    return 0;
+}
+
+/**
+ * @brief Run the jobs builtin
+ *
+ * jobs -l adds the resources every job used to the list.
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int 0 on success, 1 on a usage error
+ */
+static int builtin_jobs(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(sh)
+    if (argv[1] == NULL) {
+        print_jobs(out);
+        return 0;
+    }
+    if (strcmp(argv[1], "-l") != 0 || argv[2] != NULL) {
+        fprintf(stderr, "jobs: usage: jobs [-l]\n");
+        return 1;
+    }
+    print_jobs_long(out);
+    return 0;
+}
+
+/**
+ * @brief Run the hash builtin
+ *
+ * With no arguments the remembered commands are listed, -r forgets all of
+ * them and any other arguments are looked up and remembered.
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int 0 on success, 1 if a command was not found
+ */
+static int builtin_hash(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(sh)
+    if (argv[1] == NULL) {
+        path_hash_print(out);
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            path_hash_clear();
+        } else if (path_hash_lookup(argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief CPU time between two rusage readings
+ *
+ * @param before The first reading
+ * @param after The second reading
+ * @param user Adds user time in seconds
+ * @param sys Adds system time in seconds
+ */
+static void rusage_delta(const struct rusage *before, const struct rusage *after,
+                         double *user, double *sys) {
+    struct timeval d;
+    timersub(&after->ru_utime, &before->ru_utime, &d);
+    *user += (double)d.tv_sec + (double)d.tv_usec / 1e6;
+    timersub(&after->ru_stime, &before->ru_stime, &d);
+    *sys += (double)d.tv_sec + (double)d.tv_usec / 1e6;
+}
+
+/**
+ * @brief Run the time builtin
+ *
+ * time takes the rest of the line, pipelines included, runs it and prints
+ * to standard error how long it took and how much CPU time the shell and
+ * the jobs started by the line used, including the background jobs of a
+ * builtin such as parallel. Jobs started by earlier lines are not counted
+ * even if they are reaped meanwhile, which RUSAGE_CHILDREN would do. It
+ * follows with the phases of phase.c: parsing the line, starting its
+ * processes, their run until the last one was reaped, and the wait for
+ * the shell to get the status back.
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int Status of the command
+ */
+static int builtin_time(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(out)
+    struct rusage self_before, self_after, jobs_before, jobs_after;
+    getrusage(RUSAGE_SELF, &self_before);
+    jobs_line_usage(&jobs_before);
+    uint64_t start = phase_clock_ns();
+
+    int status = argv[1] != NULL ? execute_command(&argv[1], sh) : 0;
+
+    uint64_t real = phase_clock_ns() - start;
+    getrusage(RUSAGE_SELF, &self_after);
+    jobs_line_usage(&jobs_after);
+    double user = 0, sys = 0;
+    rusage_delta(&self_before, &self_after, &user, &sys);
+    rusage_delta(&jobs_before, &jobs_after, &user, &sys);
+
+    fflush(stdout);
+    fprintf(stderr, "\nreal\t%.6fs\nuser\t%.6fs\nsys\t%.6fs\n", (double)real / 1e9, user, sys);
+    static const char *const names[NUM_PHASES] = { "parse", "spawn", "run", "wait" };
+    for (int i = 0; i < NUM_PHASES; i++) {
+        fprintf(stderr, "%s\t%.6fs\n", names[i], (double)phase_total_ns(i) / 1e9);
+    }
+    return status;
+}
+
+/**
+ * @brief Every builtin of the shell
+ */
+static const struct builtin builtins[] = {
+    { "exit", builtin_exit, NULL, BUILTIN_SHELL },
+    { "cd", builtin_cd, NULL, BUILTIN_SHELL },
+    { "history", builtin_history, NULL, 0 },
+    { "pwd", builtin_pwd, NULL, 0 },
+    { "ls", builtin_ls, builtin_ls_accepts, 0 },
+    { "jobs", builtin_jobs, NULL, 0 },
+    { "hash", builtin_hash, NULL, 0 },
+    { "parallel", builtin_parallel, NULL, BUILTIN_SPAWNS },
+    { "time", builtin_time, NULL, BUILTIN_SHELL | BUILTIN_KEYWORD },
+    { "shstats", builtin_shstats, NULL, 0 },
+};
+
+#define NUM_BUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+static uint8_t builtin_slots[BUILTIN_SLOTS]; // Index into builtins plus one
+static uint64_t builtin_seed = 0;            // Seed of the perfect hash
+static bool builtin_slots_ready = false;     // The seed has been found
+
+/**
+ * @brief Slot of a name under a seed
+ *
+ * @param name The name
+ * @param seed The seed
+ * @return size_t Index into builtin_slots
+ */
+static size_t builtin_slot(const char *name, uint64_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)((h * 0x9e3779b97f4a7c15ULL) >> 58) & (BUILTIN_SLOTS - 1);
+}
+
+/**
+ * @brief Find a seed under which every builtin gets a slot of its own
+ *
+ * The process is aborted if no seed below BUILTIN_MAX_SEEDS works, the
+ * table then needs more BUILTIN_SLOTS.
+ */
+static void builtin_slots_init(void) {
+    _Static_assert(NUM_BUILTINS < BUILTIN_SLOTS, "too many builtins for BUILTIN_SLOTS");
+    for (uint64_t seed = 0; seed < BUILTIN_MAX_SEEDS; seed++) {
+        memset(builtin_slots, 0, sizeof(builtin_slots));
+        size_t i;
+        for (i = 0; i < NUM_BUILTINS; i++) {
+            size_t slot = builtin_slot(builtins[i].name, seed);
+            if (builtin_slots[slot] != 0) break;
+            builtin_slots[slot] = (uint8_t)(i + 1);
+        }
+        if (i == NUM_BUILTINS) {
+            builtin_seed = seed;
+            builtin_slots_ready = true;
+            return;
+        }
+    }
+    fprintf(stderr, "shell: no perfect hash for %zu builtins in %d slots, "
+            "raise BUILTIN_SLOTS\n", NUM_BUILTINS, BUILTIN_SLOTS);
+    abort();
+}
+
+/**
+ * @brief Get the table of builtins
+ *
+ * @param count Receives the number of builtins
+ * @return const struct builtin* The descriptors
+ */
+const struct builtin *builtin_table(size_t *count) {
+    *count = NUM_BUILTINS;
+    return builtins;
+}
+
+/**
+ * @brief Find the builtin with a name
+ *
+ * @param name The command name
+ * @return const struct builtin* The descriptor, NULL if there is none
+ */
+const struct builtin *builtin_lookup(const char *name) {
+    if (!builtin_slots_ready) builtin_slots_init();
+
+    uint8_t i = builtin_slots[builtin_slot(name, builtin_seed)];
+    if (i == 0 || strcmp(builtins[i - 1].name, name) != 0) return NULL;
+    return &builtins[i - 1];
+}
+
+/**
+ * @brief Check whether a command is handled by the shell itself
+ *
+ * @param argv Array of command arguments
+ * @return true if builtin_run would handle the command
+ */
+bool is_builtin(char **argv) {
+    if (argv == NULL || argv[0] == NULL) return false;
+
+    const struct builtin *b = builtin_lookup(argv[0]);
+    return b != NULL && (b->accepts == NULL || b->accepts(argv));
+}
+
+/**
+ * @brief Run a built-in command
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes its output to
+ * @param status Receives the exit status of the builtin, may be NULL
+ * @return true if the command was a built-in command, false otherwise
+ */
+bool builtin_run(struct shell *sh, char **argv, FILE *out, int *status) {
+    if (!is_builtin(argv)) return false;
+
+    int rval = builtin_lookup(argv[0])->run(sh, argv, out);
+    if (status) *status = rval;
+    return true;
+}
@@ -0,0 +1,476 @@
+/**
+ * @file exec.c
+ * @author Waylon Walsh
+ * @brief Parsing and execution of pipelines
+ * @date 2026-10-16
+ *
+ * A command line is split into pipeline stages at "|" tokens, an optional
+ * trailing "&" runs the whole pipeline in the background. Every stage is
+ * started with spawn_command into one process group, connected by pipes
+ * that are close-on-exec in the shell, and the pipeline is tracked as a
+ * single job. Background pipelines get a process group of their own as
+ * well, so keys typed at the terminal do not signal them and fg can hand
+ * them the terminal later.
+ *
+ * A builtin in the first stage is not forked. It runs inside the shell
+ * once the rest of the pipeline is started and writes into the first pipe
+ * through a pipe sink (sink.c), so `history | grep x` costs no extra
+ * process. Builtins in later stages are started like external commands.
+ *
+ * Redirections are opened by redirect.c and passed to the child as dup2
+ * spawn actions after the pipe ends, so they take precedence over them.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lab.h"
+
+/**
+ * @brief Join arguments with single spaces into a string from the arena
+ *
+ * @param a The arena to allocate from
+ * @param argv Array of arguments
+ * @return char* The joined string
+ */
+static char *join_args(struct arena *a, char **argv) {
+    size_t size = 1;
+    for (int i = 0; argv[i] != NULL; i++) {
+        size += strlen(argv[i]) + 1;
+    }
+
+    char *str = arena_alloc(a, size);
+    char *p = str;
+    for (int i = 0; argv[i] != NULL; i++) {
+        size_t len = strlen(argv[i]);
+        memcpy(p, argv[i], len);
+        p += len;
+        if (argv[i + 1] != NULL) *p++ = ' ';
+    }
+    *p = '\0';
+    return str;
+}
+
+/**
+ * @brief Report a syntax error
+ *
+ * @param token The unexpected token, NULL for the end of the line
+ */
+static void syntax_error(const char *token) {
+    fprintf(stderr, "shell: syntax error near unexpected token `%s'\n",
+            token ? token : "newline");
+}
+
+/**
+ * @brief Move the redirections of a stage out of its arguments
+ *
+ * @param a The arena to allocate from
+ * @param cmd The stage, argv is compacted in place
+ * @return true on success, false after printing a syntax error
+ */
+static bool command_parse_redirects(struct arena *a, struct command *cmd) {
+    struct redirect r;
+    size_t count = 0;
+    for (size_t i = 0; cmd->argv[i] != NULL; i++) {
+        if (redirect_parse(cmd->argv[i], &r)) count++;
+    }
+
+    cmd->redirs = NULL;
+    cmd->num_redirs = 0;
+    if (count == 0) return true;
+    cmd->redirs = arena_alloc(a, count * sizeof(struct redirect));
+
+    size_t out = 0;
+    for (size_t i = 0; cmd->argv[i] != NULL; i++) {
+        if (!redirect_parse(cmd->argv[i], &r)) {
+            cmd->argv[out++] = cmd->argv[i];
+            continue;
+        }
+        char *target = cmd->argv[i + 1];
+        if (target == NULL || is_operator(target)) {
+            syntax_error(target);
+            return false;
+        }
+        r.target = target;
+        cmd->redirs[cmd->num_redirs++] = r;
+        i++;
+    }
+    cmd->argv[out] = NULL;
+    return true;
+}
+
+/**
+ * @brief Split an argument list into pipeline stages
+ *
+ * @param a The arena to allocate from
+ * @param argv Array of arguments, the operators are replaced with NULL
+ * @return struct pipeline* The pipeline or NULL on a syntax error
+ */
+struct pipeline *pipeline_parse(struct arena *a, char **argv) {
+    if (argv == NULL || argv[0] == NULL) return NULL;
+
+    size_t stages = 1;
+    for (size_t i = 0; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "|") == 0) stages++;
+    }
+
+    struct pipeline *pl = arena_alloc(a, sizeof(struct pipeline));
+    pl->commands = arena_alloc(a, stages * sizeof(struct command));
+    pl->count = 0;
+    pl->background = false;
+
+    char **start = argv;
+    for (size_t i = 0;; i++) {
+        char *token = argv[i];
+        bool is_pipe = token != NULL && strcmp(token, "|") == 0;
+        bool is_amp = token != NULL && strcmp(token, "&") == 0;
+        if (token != NULL && !is_pipe && !is_amp) continue;
+
+        if (&argv[i] == start) {
+            // An operator with no command in front of it
+            syntax_error(token);
+            return NULL;
+        }
+        argv[i] = NULL;
+        struct command *cmd = &pl->commands[pl->count++];
+        cmd->argv = start;
+        if (!command_parse_redirects(a, cmd)) return NULL;
+        start = &argv[i + 1];
+
+        if (token == NULL) break;
+        if (is_amp) {
+            if (argv[i + 1] != NULL) {
+                syntax_error(argv[i + 1]);
+                return NULL;
+            }
+            pl->background = true;
+            break;
+        }
+    }
+    return pl;
+}
+
+/**
+ * @brief Check whether a pipeline stage can run in the shell as a producer
+ *
+ * Builtins flagged BUILTIN_SHELL, such as exit and cd, act on the shell
+ * itself, which a pipeline stage must not do, so they are left to
+ * spawn_command like any other command.
+ *
+ * @param argv Arguments of the stage
+ * @return true if the stage is a builtin that only produces output
+ */
+static bool is_producer_builtin(char **argv) {
+    return is_builtin(argv) && !(builtin_lookup(argv[0])->flags & BUILTIN_SHELL);
+}
+
+/**
+ * @brief Run a builtin stage inside the shell
+ *
+ * Without redirections the output of a builtin that feeds a pipe goes
+ * through a pipe sink. Otherwise, or when the builtin starts processes
+ * that write to the pipe too, the pipe and the redirections are applied to
+ * the shell's own descriptors while the builtin runs.
+ *
+ * @param sh Pointer to the shell structure
+ * @param cmd The stage
+ * @param pipe_fd Write end of the pipe to the next stage or -1, closed
+ * before returning
+ * @return int Status of the builtin, 1 if a redirection failed
+ */
+static int run_builtin_stage(struct shell *sh, struct command *cmd, int pipe_fd) {
+    // A reader that exits early must not take the shell down with it
+    struct sigaction ign = { .sa_handler = SIG_IGN }, old_pipe;
+    sigemptyset(&ign.sa_mask);
+    sigaction(SIGPIPE, &ign, &old_pipe);
+
+    int status = 0;
+    bool spawns = builtin_lookup(cmd->argv[0])->flags & BUILTIN_SPAWNS;
+    if (cmd->num_redirs == 0 && pipe_fd >= 0 && !spawns) {
+        FILE *out = pipe_sink_open(pipe_fd);
+        if (out != NULL) {
+            builtin_run(sh, cmd->argv, out, &status);
+            fclose(out);
+        } else {
+            perror("shell");
+            close(pipe_fd);
+            status = 1;
+        }
+        sigaction(SIGPIPE, &old_pipe, NULL);
+        return status;
+    }
+
+    size_t num_actions = 0;
+    struct spawn_action *actions = arena_alloc(&sh->arena,
+        (cmd->num_redirs + 1) * sizeof(struct spawn_action));
+    if (pipe_fd >= 0) {
+        actions[num_actions++] = (struct spawn_action){ STDOUT_FILENO, pipe_fd };
+    }
+
+    if (redirect_open(cmd->redirs, cmd->num_redirs, actions + num_actions) < 0) {
+        status = 1;
+    } else {
+        num_actions += cmd->num_redirs;
+        int *saved = arena_alloc(&sh->arena, num_actions * sizeof(int));
+        fflush(stdout);
+        if (redirect_apply(actions, num_actions, saved) < 0) {
+            status = 1;
+        } else {
+            builtin_run(sh, cmd->argv, stdout, &status);
+            fflush(stdout);
+            redirect_restore(actions, num_actions, saved);
+        }
+        redirect_close(cmd->redirs, cmd->num_redirs, actions + (pipe_fd >= 0));
+    }
+    if (pipe_fd >= 0) close(pipe_fd);
+
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    return status;
+}
+
+/**
+ * @brief Split the time since the last spawn of a foreground job into the
+ * time its processes ran and the time it took the shell to notice
+ *
+ * @param spawned When the last process of the job was started
+ */
+static void add_wait_phases(uint64_t spawned) {
+    uint64_t now = phase_clock_ns();
+    struct job_usage usage;
+    job_last_usage(&usage);
+    uint64_t reaped = (uint64_t)usage.finished.tv_sec * 1000000000u +
+                      (uint64_t)usage.finished.tv_nsec;
+
+    // A stopped job has not finished, all of the time is its own
+    if (reaped < spawned || reaped > now) reaped = now;
+    phase_add(PHASE_RUN, reaped - spawned);
+    phase_add(PHASE_WAIT, now - reaped);
+}
+
+/**
+ * @brief Start every stage of a pipeline and track it as one job
+ *
+ * @param sh Pointer to the shell structure
+ * @param pl The pipeline
+ * @param command Command string of the job
+ * @param job_id Receives the ID of a background job instead of it being
+ * announced, 0 if no job was started, may be NULL
+ * @return int Exit status of the last stage, 0 for background jobs
+ */
+static int run_pipeline(struct shell *sh, struct pipeline *pl, char *command, int *job_id) {
+    bool foreground = !pl->background;
+    pid_t *pids = arena_alloc(&sh->arena, pl->count * sizeof(pid_t));
+    int num_pids = 0;
+    pid_t pgid = 0;
+    int in_fd = -1;
+    int producer_fd = -1;
+    size_t first = 0;
+    int no_pid_status = 127;
+    bool last_failed = false;  // The last stage started no process
+    if (job_id) *job_id = 0;
+
+    // Keep the SIGCHLD handler, when jobs has no pidfds, from reaping a
+    // child before its job is recorded and its pidfd can still be opened
+    sigset_t chld, old_mask;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old_mask);
+
+    // Output of earlier builtins must come before anything the children
+    // write, stdout is fully buffered when it is not a terminal
+    fflush(stdout);
+
+    // A lone builtin only gets here when it has redirections
+    char **head = pl->commands[0].argv;
+    if (pl->count == 1 && foreground && is_builtin(head)) {
+        first = 1;
+    } else if (pl->count > 1 && is_producer_builtin(head)) {
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) < 0) {
+            perror("shell");
+            sigprocmask(SIG_SETMASK, &old_mask, NULL);
+            return 1;
+        }
+        producer_fd = pipefd[1];
+        in_fd = pipefd[0];
+        first = 1;
+    }
+
+    for (size_t i = first; i < pl->count; i++) {
+        struct command *cmd = &pl->commands[i];
+        int pipefd[2] = { -1, -1 };
+        if (i + 1 < pl->count && pipe2(pipefd, O_CLOEXEC) < 0) {
+            perror("shell");
+            break;
+        }
+
+        // Pipe ends first so the stage's own redirections override them
+        struct spawn_action *actions = arena_alloc(&sh->arena,
+            (cmd->num_redirs + 2) * sizeof(struct spawn_action));
+        size_t num_actions = 0;
+        if (in_fd >= 0) {
+            actions[num_actions++] = (struct spawn_action){ STDIN_FILENO, in_fd };
+        }
+        if (pipefd[1] >= 0) {
+            actions[num_actions++] = (struct spawn_action){ STDOUT_FILENO, pipefd[1] };
+        }
+        struct spawn_action *redir_actions = actions + num_actions;
+        bool redirected = redirect_open(cmd->redirs, cmd->num_redirs, redir_actions) == 0;
+        num_actions += cmd->num_redirs;
+
+        // The first process started leads the group and takes the terminal
+        struct spawn_opts opts = {
+            .pgid = pgid,
+            .terminal = -1,
+            .actions = actions,
+            .num_actions = num_actions,
+        };
+        if (pgid == 0 && foreground && sh->shell_is_interactive) {
+            opts.terminal = sh->shell_terminal;
+        }
+
+        pid_t pid = -1;
+        if (!redirected) {
+            no_pid_status = 1;
+        } else if (cmd->argv[0] == NULL) {
+            // Only redirections, the files are created and nothing runs
+            no_pid_status = 0;
+        } else {
+            uint64_t start = phase_clock_ns();
+            pid = spawn_command(cmd->argv, &opts);
+            phase_add(PHASE_SPAWN, phase_clock_ns() - start);
+            if (pid < 0) {
+                perror("shell");
+                no_pid_status = 127;
+                // A failed exec may have already handed the terminal to the child
+                if (opts.terminal >= 0) {
+                    tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+                }
+            }
+        }
+
+        // The children hold their own copies of the descriptors now
+        if (redirected) redirect_close(cmd->redirs, cmd->num_redirs, redir_actions);
+        if (in_fd >= 0) close(in_fd);
+        if (pipefd[1] >= 0) close(pipefd[1]);
+        in_fd = pipefd[0];
+
+        if (pid < 0) {
+            last_failed = i + 1 == pl->count;
+            continue;
+        }
+        if (pgid == 0) pgid = pid;
+        setpgid(pid, pgid);
+        pids[num_pids++] = pid;
+    }
+    if (in_fd >= 0) close(in_fd);
+    uint64_t spawned = phase_clock_ns();
+
+    // The readers are running, so the builtin cannot fill the pipe and stall
+    int status = 0;
+    if (first == 1) {
+        status = run_builtin_stage(sh, &pl->commands[0], producer_fd);
+    }
+
+    if (num_pids == 0) {
+        // Nothing to wait for, a lone builtin already has its status
+        if (pl->count > first) status = no_pid_status;
+        if (foreground) phase_add(PHASE_RUN, phase_clock_ns() - spawned);
+    } else {
+        int id = add_pipeline_job(pids, num_pids, command, pl->background);
+        if (id < 0) {
+            fprintf(stderr, "shell: unable to track job %s\n", command);
+            for (int i = 0; foreground && i < num_pids; i++) {
+                waitpid(pids[i], NULL, 0);
+            }
+        } else if (job_id != NULL) {
+            *job_id = id;
+        } else if (!foreground) {
+            if (!sh->batch) printf("[%d] %d %s\n", id, pgid, command);
+        } else {
+            if (sh->shell_is_interactive) {
+                tcsetpgrp(sh->shell_terminal, pgid);
+            }
+            status = wait_for_job(id);
+            if (sh->shell_is_interactive) {
+                tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+            }
+            add_wait_phases(spawned);
+            // The status of the pipeline is the one of its last stage
+            if (last_failed) status = no_pid_status;
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return status;
+}
+
+/**
+ * @brief Parse a command into a pipeline and run it
+ *
+ * @param argv Array of command arguments
+ * @param sh Pointer to the shell structure
+ * @return int Status of the command execution
+ */
+static int run_command(char **argv, struct shell *sh) {
+
+    uint64_t start = phase_clock_ns();
+    char *command = join_args(&sh->arena, argv);
+    struct pipeline *pl = pipeline_parse(&sh->arena, argv);
+    phase_add(PHASE_PARSE, phase_clock_ns() - start);
+    if (pl == NULL) {
+        return 2;
+    }
+    return run_pipeline(sh, pl, command, NULL);
+}
+
+/**
+ * @brief Execute a command
+ *
+ * This function splits the command into pipeline stages, starts each of
+ * them with spawn_command and waits for the pipeline unless it runs in the
+ * background.
+ *
+ * @param argv Array of command arguments
+ * @param sh Pointer to the shell structure
+ * @return int Status of the command execution
+ */
+int execute_command(char **argv, struct shell *sh) {
+    if (argv == NULL || argv[0] == NULL) {
+        return 1;
+    }
+
+    int status;
+    STATS_MEASURE(STAT_EXECUTE, status = run_command(argv, sh));
+    return status;
+}
+
+/**
+ * @brief Start a command as a background job without announcing it
+ *
+ * @param argv Array of command arguments, a trailing & is not needed
+ * @param sh Pointer to the shell structure
+ * @param status Receives the status of the command when no job was started
+ * @return int The ID of the job, 0 if no process was started
+ */
+int start_job(char **argv, struct shell *sh, int *status) {
+    *status = 1;
+    if (argv == NULL || argv[0] == NULL) return 0;
+
+    char *command = join_args(&sh->arena, argv);
+    struct pipeline *pl = pipeline_parse(&sh->arena, argv);
+    if (pl == NULL) {
+        *status = 2;
+        return 0;
+    }
+    pl->background = true;
+
+    int job_id;
+    *status = run_pipeline(sh, pl, command, &job_id);
+    return job_id;
+}
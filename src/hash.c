@@ -0,0 +1,282 @@
+/**
+ * @file hash.c
+ * @author Waylon Walsh
+ * @brief Cache of resolved command paths, in the spirit of the bash hash
+ * table
+ * @date 2026-10-16
+ *
+ * Looking a command up in PATH costs one failed execve per directory that
+ * does not contain it. The first lookup of a name walks PATH once and the
+ * absolute path is remembered until PATH changes, the cached file goes
+ * away, or the user clears the table with `hash -r`. A command found
+ * through an empty, `.` or other relative PATH element is not remembered,
+ * since a cd changes what it refers to, and PATH is walked again the next
+ * time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lab.h"
+
+#define PATH_HASH_INITIAL_SIZE 64 // Must be a power of two
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/**
+ * @brief One remembered command
+ */
+struct path_entry {
+    char *name;    // Command name as typed by the user
+    char *path;    // Absolute path it resolved to
+    unsigned hits; // Number of times the entry was used
+};
+
+static struct path_entry *path_table = NULL; // Open addressing table
+static size_t path_table_size = 0;           // Number of slots
+static size_t path_table_count = 0;          // Number of live entries
+static char *path_table_env = NULL;          // PATH the entries were resolved with
+static char *path_uncached = NULL;           // Last path found in a relative directory
+
+/**
+ * @brief FNV-1a hash of a command name
+ *
+ * @param name The command name
+ * @return size_t The hash value
+ */
+static size_t path_hash_string(const char *name) {
+    size_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Find the slot holding name, or the empty slot where it belongs
+ *
+ * @param name The command name
+ * @return size_t Index of the slot
+ */
+static size_t path_hash_slot(const char *name) {
+    size_t mask = path_table_size - 1;
+    size_t i = path_hash_string(name) & mask;
+    while (path_table[i].name != NULL && strcmp(path_table[i].name, name) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Double the size of the table and rehash every entry
+ *
+ * @return int 0 on success, -1 if memory could not be allocated
+ */
+static int path_hash_grow(void) {
+    struct path_entry *old = path_table;
+    size_t old_size = path_table_size;
+    size_t new_size = old_size ? old_size * 2 : PATH_HASH_INITIAL_SIZE;
+
+    struct path_entry *table = calloc(new_size, sizeof(struct path_entry));
+    if (!table) return -1;
+
+    path_table = table;
+    path_table_size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].name != NULL) {
+            path_table[path_hash_slot(old[i].name)] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief Remove the entry in slot i, shifting the rest of its probe run back
+ *
+ * @param i Index of an occupied slot
+ */
+static void path_hash_remove_slot(size_t i) {
+    size_t mask = path_table_size - 1;
+
+    free(path_table[i].name);
+    free(path_table[i].path);
+    path_table[i].name = NULL;
+    path_table[i].path = NULL;
+    path_table_count--;
+
+    // Backward shift deletion keeps probe runs intact without tombstones
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (path_table[j].name == NULL) break;
+        size_t home = path_hash_string(path_table[j].name) & mask;
+        // Move j into the hole unless its home lies cyclically in (i, j]
+        bool in_range = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!in_range) {
+            path_table[i] = path_table[j];
+            path_table[j].name = NULL;
+            path_table[j].path = NULL;
+            i = j;
+        }
+    }
+}
+
+/**
+ * @brief Walk PATH looking for an executable regular file called name
+ *
+ * @param name The command name, must not contain a slash
+ * @param env The value of PATH to search
+ * @param relative Set to true if the file was found in a directory that
+ * is relative to the current one
+ * @return char* Newly allocated path, or NULL if not found
+ */
+static char *path_hash_resolve(const char *name, const char *env, bool *relative) {
+    size_t name_len = strlen(name);
+    const char *dir = env;
+
+    for (;;) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+        // An empty PATH element means the current directory
+        char *candidate = malloc(dir_len + name_len + 3);
+        if (!candidate) return NULL;
+        if (dir_len == 0) {
+            memcpy(candidate, ".", 1);
+            dir_len = 1;
+        } else {
+            memcpy(candidate, dir, dir_len);
+        }
+        candidate[dir_len] = '/';
+        memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(candidate, X_OK) == 0) {
+            *relative = candidate[0] != '/';
+            return candidate;
+        }
+        free(candidate);
+
+        if (!end) return NULL;
+        dir = end + 1;
+    }
+}
+
+/**
+ * @brief Drop every entry if PATH changed since the entries were resolved
+ *
+ * @param env The current value of PATH
+ */
+static void path_hash_check_env(const char *env) {
+    if (path_table_env != NULL && strcmp(path_table_env, env) == 0) return;
+
+    path_hash_clear();
+    path_table_env = strdup(env);
+}
+
+/**
+ * @brief Look up the path of a command
+ *
+ * @param name The command name
+ * @return const char* The cached path or NULL with errno set. A path
+ * found in a relative PATH element is not cached and only stays valid
+ * until the next lookup.
+ */
+const char *path_hash_lookup(const char *name) {
+    if (name == NULL || *name == '\0' || strchr(name, '/') != NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    const char *env = getenv("PATH");
+    if (env == NULL) env = DEFAULT_PATH;
+    path_hash_check_env(env);
+
+    if (path_table_count * 2 >= path_table_size && path_hash_grow() != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size_t i = path_hash_slot(name);
+    if (path_table[i].name == NULL) {
+        bool relative = false;
+        char *path = path_hash_resolve(name, env, &relative);
+        if (path == NULL) {
+            errno = ENOENT;
+            return NULL;
+        }
+        if (relative) {
+            free(path_uncached);
+            path_uncached = path;
+            return path;
+        }
+        char *copy = strdup(name);
+        if (copy == NULL) {
+            free(path);
+            errno = ENOMEM;
+            return NULL;
+        }
+        path_table[i].name = copy;
+        path_table[i].path = path;
+        path_table[i].hits = 0;
+        path_table_count++;
+    }
+    path_table[i].hits++;
+    return path_table[i].path;
+}
+
+/**
+ * @brief Forget the cached path of a single command
+ *
+ * @param name The command name
+ */
+void path_hash_forget(const char *name) {
+    if (path_table_count == 0 || name == NULL) return;
+
+    size_t i = path_hash_slot(name);
+    if (path_table[i].name != NULL) {
+        path_hash_remove_slot(i);
+    }
+}
+
+/**
+ * @brief Forget every cached path and release the table
+ */
+void path_hash_clear(void) {
+    for (size_t i = 0; i < path_table_size; i++) {
+        free(path_table[i].name);
+        free(path_table[i].path);
+    }
+    free(path_table);
+    free(path_table_env);
+    free(path_uncached);
+    path_table = NULL;
+    path_table_env = NULL;
+    path_uncached = NULL;
+    path_table_size = 0;
+    path_table_count = 0;
+}
+
+/**
+ * @brief Print the cached commands with their hit counts
+ *
+ * @param out Stream to print to
+ */
+void path_hash_print(FILE *out) {
+    if (path_table_count == 0) {
+        fprintf(out, "hash: hash table empty\n");
+        return;
+    }
+
+    fprintf(out, "hits\tcommand\n");
+    for (size_t i = 0; i < path_table_size; i++) {
+        if (path_table[i].name != NULL) {
+            fprintf(out, "%4u\t%s\n", path_table[i].hits, path_table[i].path);
+        }
+    }
+}
@@ -0,0 +1,298 @@
+/**
+ * @file history.c
+ * @author Waylon Walsh
+ * @brief Persistent command history shared by every session
+ * @date 2026-10-16
+ *
+ * History lives in two files. The log holds one command per line and is
+ * only ever appended to. The index next to it (the log name plus ".idx")
+ * holds the byte offset of every entry in the log as a native uint64_t,
+ * so entry n is found with one array access and nothing has to be read
+ * when the shell starts. Both files are mapped lazily the first time an
+ * entry is looked up and mapped again when another session made them
+ * grow.
+ *
+ * Sessions append while holding an exclusive flock on the log. The log
+ * line is written before its index entry, so a reader that sees an index
+ * entry also sees its line. Under the lock, hist_add first checks that the
+ * index agrees with the end of the log and indexes any lines a crashed
+ * session left without an entry. flock locks belong to the open file, so
+ * a forked process has to call hist_open itself before it appends.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "lab.h"
+
+#define HIST_DEFAULT_NAME ".lab_history" // Log file in the home directory
+#define HIST_SCAN_SIZE 65536             // Block size when scanning the log
+
+/**
+ * @brief A file mapped read only, remapped when it grows
+ */
+struct hist_map {
+    int fd;           // Descriptor of the file
+    const char *data; // Mapping, NULL if the file was empty
+    size_t size;      // Size of the mapping
+};
+
+static struct hist_map hist_log = { -1, NULL, 0 }; // The commands
+static struct hist_map hist_idx = { -1, NULL, 0 }; // Offsets of the commands
+
+/**
+ * @brief Map a file again if its size changed
+ *
+ * @param m The mapping
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int hist_map_update(struct hist_map *m) {
+    struct stat st;
+    if (fstat(m->fd, &st) < 0) return -1;
+    if ((size_t)st.st_size == m->size) return 0;
+
+    if (m->data != NULL) munmap((void *)m->data, m->size);
+    m->data = NULL;
+    m->size = 0;
+    if (st.st_size == 0) return 0;
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (data == MAP_FAILED) return -1;
+    m->data = data;
+    m->size = (size_t)st.st_size;
+    return 0;
+}
+
+/**
+ * @brief Unmap and close a file
+ *
+ * @param m The mapping
+ */
+static void hist_map_close(struct hist_map *m) {
+    if (m->data != NULL) munmap((void *)m->data, m->size);
+    if (m->fd >= 0) close(m->fd);
+    m->fd = -1;
+    m->data = NULL;
+    m->size = 0;
+}
+
+/**
+ * @brief Open the history files
+ *
+ * @param path Path of the log, NULL for $HISTFILE or ~/.lab_history
+ * @return int 0 on success, -1 on error with errno set
+ */
+int hist_open(const char *path) {
+    hist_close();
+
+    char *default_path = NULL;
+    if (path == NULL) path = getenv("HISTFILE");
+    if (path == NULL) {
+        const char *home = getenv("HOME");
+        if (home == NULL) {
+            errno = ENOENT;
+            return -1;
+        }
+        default_path = malloc(strlen(home) + sizeof(HIST_DEFAULT_NAME) + 1);
+        if (!default_path) return -1;
+        sprintf(default_path, "%s/%s", home, HIST_DEFAULT_NAME);
+        path = default_path;
+    }
+
+    char *idx_path = malloc(strlen(path) + 5);
+    if (!idx_path) {
+        free(default_path);
+        return -1;
+    }
+    sprintf(idx_path, "%s.idx", path);
+
+    hist_log.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    hist_idx.fd = open(idx_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    int err = errno;
+    free(idx_path);
+    free(default_path);
+
+    if (hist_log.fd < 0 || hist_idx.fd < 0) {
+        hist_close();
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close the history files
+ */
+void hist_close(void) {
+    hist_search_reset();
+    hist_map_close(&hist_log);
+    hist_map_close(&hist_idx);
+}
+
+/**
+ * @brief Index the log lines that have no index entry
+ *
+ * Called with the log locked. Index entries that point past the end of
+ * the log are dropped, a last line without a newline is completed, and
+ * every line after the last indexed one gets an entry.
+ *
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int hist_repair(void) {
+    struct stat log_st, idx_st;
+    if (fstat(hist_log.fd, &log_st) < 0 || fstat(hist_idx.fd, &idx_st) < 0) return -1;
+
+    off_t log_size = log_st.st_size;
+    off_t entries = idx_st.st_size / (off_t)sizeof(uint64_t);
+    uint64_t last = 0;
+    while (entries > 0) {
+        if (pread(hist_idx.fd, &last, sizeof(last), (entries - 1) * (off_t)sizeof(uint64_t)) !=
+            sizeof(last)) {
+            return -1;
+        }
+        if ((off_t)last < log_size) break;
+        entries--;
+    }
+    if (entries * (off_t)sizeof(uint64_t) != idx_st.st_size &&
+        ftruncate(hist_idx.fd, entries * (off_t)sizeof(uint64_t)) < 0) {
+        return -1;
+    }
+
+    // Walk the log from the last indexed line, indexing each line start
+    char buf[HIST_SCAN_SIZE];
+    off_t pos = entries > 0 ? (off_t)last : 0;
+    bool line_start = entries == 0;
+    while (pos < log_size) {
+        ssize_t n = pread(hist_log.fd, buf, sizeof(buf), pos);
+        if (n <= 0) return -1;
+        for (ssize_t i = 0; i < n; i++) {
+            if (line_start) {
+                uint64_t offset = (uint64_t)(pos + i);
+                if (write(hist_idx.fd, &offset, sizeof(offset)) != sizeof(offset)) return -1;
+                line_start = false;
+            }
+            if (buf[i] == '\n') line_start = true;
+        }
+        pos += n;
+    }
+    if (!line_start && write(hist_log.fd, "\n", 1) != 1) return -1;
+    return 0;
+}
+
+/**
+ * @brief Append a command to the history
+ *
+ * @param line The command, it must not contain a newline
+ * @param n Receives the number of the new entry, may be NULL
+ * @return int 0 on success, -1 on error with errno set
+ */
+int hist_add(const char *line, size_t *n) {
+    if (hist_log.fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (*line == '\0' || strchr(line, '\n') != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (flock(hist_log.fd, LOCK_EX) < 0) return -1;
+
+    int rval = -1;
+    struct stat st, idx_st;
+    if (hist_repair() == 0 && fstat(hist_log.fd, &st) == 0 &&
+        fstat(hist_idx.fd, &idx_st) == 0) {
+        uint64_t offset = (uint64_t)st.st_size;
+        struct iovec iov[2] = {
+            { (void *)line, strlen(line) },
+            { "\n", 1 },
+        };
+        ssize_t len = (ssize_t)(iov[0].iov_len + 1);
+        if (writev(hist_log.fd, iov, 2) == len &&
+            write(hist_idx.fd, &offset, sizeof(offset)) == sizeof(offset)) {
+            if (n) *n = (size_t)idx_st.st_size / sizeof(uint64_t) + 1;
+            rval = 0;
+        }
+    }
+
+    int err = errno;
+    flock(hist_log.fd, LOCK_UN);
+    errno = err;
+    return rval;
+}
+
+/**
+ * @brief Number of entries in the history
+ *
+ * @return size_t The number of entries, 0 if the history is not open
+ */
+size_t hist_count(void) {
+    struct stat st;
+    if (hist_idx.fd < 0 || fstat(hist_idx.fd, &st) < 0) return 0;
+    return (size_t)st.st_size / sizeof(uint64_t);
+}
+
+/**
+ * @brief Look up a history entry by number
+ *
+ * @param n Number of the entry, the first entry is 1
+ * @param len Receives the length of the entry
+ * @return const char* The entry, not terminated and valid until the next
+ * call to a hist_ function, or NULL if there is no such entry
+ */
+const char *hist_get(size_t n, size_t *len) {
+    if (hist_idx.fd < 0 || n == 0) return NULL;
+
+    if (n > hist_idx.size / sizeof(uint64_t)) {
+        // Another session may have added entries since the last lookup
+        if (hist_map_update(&hist_idx) < 0) return NULL;
+        if (n > hist_idx.size / sizeof(uint64_t)) return NULL;
+    }
+
+    const uint64_t *offsets = (const uint64_t *)hist_idx.data;
+    size_t offset = (size_t)offsets[n - 1];
+    const char *nl = NULL;
+    if (offset < hist_log.size) {
+        nl = memchr(hist_log.data + offset, '\n', hist_log.size - offset);
+    }
+    if (nl == NULL) {
+        if (hist_map_update(&hist_log) < 0 || offset >= hist_log.size) return NULL;
+        nl = memchr(hist_log.data + offset, '\n', hist_log.size - offset);
+        if (nl == NULL) return NULL;
+    }
+
+    *len = (size_t)(nl - (hist_log.data + offset));
+    return hist_log.data + offset;
+}
+
+/**
+ * @brief Expand a !n history reference
+ *
+ * @param line The line typed by the user
+ * @return char* A newly allocated copy of entry n if the line is !n, a
+ * copy of the line otherwise, or NULL after printing an error if there is
+ * no entry n
+ */
+char *hist_expand(const char *line) {
+    if (line[0] != '!' || line[1] < '0' || line[1] > '9') return strdup(line);
+
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(line + 1, &end, 10);
+    size_t len = 0;
+    const char *entry = NULL;
+    if (errno == 0 && *end == '\0') entry = hist_get((size_t)n, &len);
+    if (entry == NULL) {
+        fprintf(stderr, "shell: %s: event not found\n", line);
+        return NULL;
+    }
+    return strndup(entry, len);
+}
@@ -0,0 +1,1063 @@
+/**
+ * @file jobs.c
+ * @author Waylon Walsh
+ * @brief Job table and child reaping
+ * @date 2026-10-16
+ *
+ * A job is a pipeline of one or more processes that share a process group.
+ * Jobs live in a growable array of slots. Free slots are chained on a free
+ * list, live jobs on a list kept in job id order, and two hash indices map
+ * job ids and pids to slots, so every lookup is O(1) no matter how many
+ * background jobs are running.
+ *
+ * Every process of a job is tracked through a pidfd opened while SIGCHLD
+ * is blocked, before the child can be reaped, so it always refers to the
+ * right process even after its pid is reused. The pidfds are in one epoll
+ * set that becomes readable when any of them exits. The interactive event
+ * loop watches that set, and update_job_status collects the exited
+ * processes with waitid(P_PIDFD), so thousands of jobs cost one descriptor
+ * in the loop and no work until one of them exits.
+ *
+ * On kernels without pidfds children are reaped by the SIGCHLD handler as
+ * soon as they exit. The handler only records pid and status in a ring,
+ * update_job_status consumes it outside of signal context and marks the
+ * matching jobs done. It also writes a byte to a pipe the event loop
+ * watches instead of the epoll set. A process whose pidfd could not be
+ * opened, when descriptors run out, is polled with waitpid instead.
+ *
+ * Every way of reaping a child also returns its resource usage, waitid
+ * through the system call that takes a struct rusage and wait4 elsewhere.
+ * A job sums the usage of its processes and remembers when it started and
+ * finished, for jobs -l, the Done notification and job_last_usage. The
+ * usage of every job started by the current command line is summed as
+ * well, for the time builtin.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "lab.h"
+
+#define JOBS_INITIAL_SIZE 16  // Slots allocated for the first job
+#define REAP_RING_SIZE 256    // Reaped children buffered between prompts
+#define NO_SLOT -1            // End of the free and live lists
+#define PIDFD_NONE -1         // Process is not tracked, not a child of ours
+#define PIDFD_POLLED -2       // Process has no pidfd and is polled
+#define PIDFD_EVENTS 64       // Exited processes collected per epoll_wait
+#define POLLED_WAIT_MS 10     // Wait between polls of processes without pidfd
+
+/**
+ * @brief Structure to represent a job in the shell
+ */
+struct job {
+    int job_id;          // Unique identifier for the job, 0 if the slot is free
+    pid_t pid;           // Process ID of the job, leader of its process group
+    pid_t *pids;         // Every process of the pipeline, pids[0] == pid
+    int *pidfds;         // pidfd of each process, or PIDFD_NONE or PIDFD_POLLED
+    int num_pids;        // Number of processes in pids
+    int pids_size;       // Capacity of pids, kept when the slot is reused
+    int live_pids;       // Processes that have not been reaped yet
+    int status;          // Wait status of the last process of the pipeline
+    char *command;       // Command string of the job
+    size_t command_size; // Capacity of command, kept when the slot is reused
+    bool is_background;  // Flag to indicate if it's a background job
+    bool is_stopped;     // Flag to indicate if the job was stopped
+    bool is_done;        // Flag to indicate if the job is completed
+    struct job_usage usage; // Resources used by the reaped processes
+    int prev;            // Previous live job, in job id order
+    int next;            // Next live job, or next free slot
+};
+
+/**
+ * @brief Open addressing map from a positive int key to a slot index
+ */
+struct slot_index {
+    int *keys;   // 0 marks an empty bucket
+    int *slots;  // Slot of the job with the key
+    size_t size; // Number of buckets, a power of two
+};
+
+static struct job *jobs = NULL;     // Array to store all jobs
+static int jobs_size = 0;           // Number of slots in jobs
+static int free_head = NO_SLOT;     // First free slot
+static int live_head = NO_SLOT;     // Live job with the smallest id
+static int live_tail = NO_SLOT;     // Live job with the largest id
+static struct slot_index id_index;  // Job id to slot
+static struct slot_index pid_index; // Process id to slot, for live processes
+static int num_live_pids = 0;       // Keys in pid_index
+
+static volatile pid_t reaped_pids[REAP_RING_SIZE];
+static volatile int reaped_status[REAP_RING_SIZE];
+static struct rusage reaped_usage[REAP_RING_SIZE];
+static volatile sig_atomic_t reaped_head = 0;     // Next entry to consume
+static volatile sig_atomic_t reaped_tail = 0;     // Next entry to fill
+static volatile sig_atomic_t reaped_overflow = 0; // Ring filled up while reaping
+static int notify_pipe[2] = { -1, -1 };           // Written to by the handler
+
+static enum reap_mode reap_mode = REAP_AUTO;
+static bool use_pidfd = false; // Children are tracked with pidfds
+static int pidfd_epoll = -1;   // epoll set of the pidfds of live processes
+static int num_polled = 0;     // Live processes with PIDFD_POLLED
+
+static struct job_usage last_usage; // Last foreground job that finished
+static struct timespec line_start;  // When the current command line began
+static struct rusage line_usage;    // Jobs started since line_start
+
+/**
+ * @brief Hash an int key to a bucket
+ *
+ * @param idx The index
+ * @param key The key
+ * @return size_t Home bucket of the key
+ */
+static size_t slot_index_home(const struct slot_index *idx, int key) {
+    // Multiplicative hashing spreads the sequential ids and pids we see
+    unsigned h = (unsigned)key * 2654435769u;
+    return (size_t)(h ^ (h >> 16)) & (idx->size - 1);
+}
+
+/**
+ * @brief Find the bucket holding key, or the empty bucket where it belongs
+ *
+ * @param idx The index
+ * @param key The key
+ * @return size_t The bucket
+ */
+static size_t slot_index_bucket(const struct slot_index *idx, int key) {
+    size_t mask = idx->size - 1;
+    size_t i = slot_index_home(idx, key);
+    while (idx->keys[i] != 0 && idx->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Look up the slot of a key
+ *
+ * @param idx The index
+ * @param key The key
+ * @return int The slot or NO_SLOT
+ */
+static int slot_index_get(const struct slot_index *idx, int key) {
+    if (idx->size == 0 || key <= 0) return NO_SLOT;
+    size_t i = slot_index_bucket(idx, key);
+    return idx->keys[i] == key ? idx->slots[i] : NO_SLOT;
+}
+
+/**
+ * @brief Resize the index to the given number of buckets
+ *
+ * @param idx The index
+ * @param size New number of buckets, a power of two
+ * @return int 0 on success, -1 if memory could not be allocated
+ */
+static int slot_index_resize(struct slot_index *idx, size_t size) {
+    int *keys = calloc(size, sizeof(int));
+    int *slots = malloc(size * sizeof(int));
+    if (!keys || !slots) {
+        free(keys);
+        free(slots);
+        return -1;
+    }
+
+    struct slot_index old = *idx;
+    idx->keys = keys;
+    idx->slots = slots;
+    idx->size = size;
+    for (size_t i = 0; i < old.size; i++) {
+        if (old.keys[i] != 0) {
+            size_t b = slot_index_bucket(idx, old.keys[i]);
+            idx->keys[b] = old.keys[i];
+            idx->slots[b] = old.slots[i];
+        }
+    }
+    free(old.keys);
+    free(old.slots);
+    return 0;
+}
+
+/**
+ * @brief Map a key to a slot. The index must have room, which the callers
+ * guarantee by sizing it at twice the number of slots.
+ *
+ * @param idx The index
+ * @param key The key
+ * @param slot The slot
+ */
+static void slot_index_put(struct slot_index *idx, int key, int slot) {
+    size_t i = slot_index_bucket(idx, key);
+    idx->keys[i] = key;
+    idx->slots[i] = slot;
+}
+
+/**
+ * @brief Remove a key from the index
+ *
+ * @param idx The index
+ * @param key The key
+ */
+static void slot_index_remove(struct slot_index *idx, int key) {
+    if (idx->size == 0 || key <= 0) return;
+
+    size_t mask = idx->size - 1;
+    size_t i = slot_index_bucket(idx, key);
+    if (idx->keys[i] != key) return;
+    idx->keys[i] = 0;
+
+    // Backward shift deletion keeps probe runs intact without tombstones
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (idx->keys[j] == 0) break;
+        size_t home = slot_index_home(idx, idx->keys[j]);
+        bool in_range = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!in_range) {
+            idx->keys[i] = idx->keys[j];
+            idx->slots[i] = idx->slots[j];
+            idx->keys[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/**
+ * @brief Double the number of slots and put the new ones on the free list
+ *
+ * @return int 0 on success, -1 if memory could not be allocated
+ */
+static int grow_jobs(void) {
+    int size = jobs_size ? jobs_size * 2 : JOBS_INITIAL_SIZE;
+
+    // Keep each index at most half full
+    if (slot_index_resize(&id_index, (size_t)size * 2) != 0) {
+        return -1;
+    }
+
+    struct job *grown = realloc(jobs, (size_t)size * sizeof(struct job));
+    if (!grown) return -1;
+    jobs = grown;
+
+    for (int i = size - 1; i >= jobs_size; i--) {
+        memset(&jobs[i], 0, sizeof(struct job));
+        jobs[i].prev = NO_SLOT;
+        jobs[i].next = free_head;
+        free_head = i;
+    }
+    jobs_size = size;
+    return 0;
+}
+
+/**
+ * @brief Make sure the pid index has room for more processes
+ *
+ * @param count Number of processes about to be added
+ * @return int 0 on success, -1 if memory could not be allocated
+ */
+static int reserve_pids(int count) {
+    size_t size = pid_index.size ? pid_index.size : JOBS_INITIAL_SIZE * 2;
+    while ((size_t)(num_live_pids + count) * 2 > size) {
+        size *= 2;
+    }
+    if (size == pid_index.size) return 0;
+    return slot_index_resize(&pid_index, size);
+}
+
+/**
+ * @brief Open a pidfd for a process of a job and add it to the epoll set
+ *
+ * @param job The job
+ * @param i Index of the process
+ */
+static void pidfd_track(struct job *job, int i) {
+    job->pidfds[i] = PIDFD_NONE;
+    if (!use_pidfd) return;
+
+    int fd = (int)syscall(SYS_pidfd_open, job->pids[i], 0);
+    if (fd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint64_t)job->pids[i] };
+        if (epoll_ctl(pidfd_epoll, EPOLL_CTL_ADD, fd, &ev) == 0) {
+            job->pidfds[i] = fd;
+            return;
+        }
+        close(fd);
+    } else if (errno == ESRCH) {
+        return;  // Not a process we started
+    }
+    job->pidfds[i] = PIDFD_POLLED;
+    num_polled++;
+}
+
+/**
+ * @brief Stop tracking a process of a job
+ *
+ * @param job The job
+ * @param i Index of the process
+ */
+static void pidfd_untrack(struct job *job, int i) {
+    if (job->pidfds[i] >= 0) {
+        epoll_ctl(pidfd_epoll, EPOLL_CTL_DEL, job->pidfds[i], NULL);
+        close(job->pidfds[i]);
+    } else if (job->pidfds[i] == PIDFD_POLLED) {
+        num_polled--;
+    }
+    job->pidfds[i] = PIDFD_NONE;
+}
+
+/**
+ * @brief Index of a process in its job
+ *
+ * @param job The job
+ * @param pid The process
+ * @return int The index, -1 if the process is not part of the job
+ */
+static int process_index(const struct job *job, pid_t pid) {
+    for (int i = 0; i < job->num_pids; i++) {
+        if (job->pids[i] == pid) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Convert what waitid reports to a wait status
+ *
+ * @param si The siginfo filled in by waitid
+ * @return int The wait status waitpid would have reported
+ */
+static int siginfo_status(const siginfo_t *si) {
+    switch (si->si_code) {
+    case CLD_EXITED:
+        return (si->si_status & 0xff) << 8;
+    case CLD_KILLED:
+        return si->si_status & 0x7f;
+    case CLD_DUMPED:
+        return (si->si_status & 0x7f) | 0x80;
+    case CLD_STOPPED:
+    case CLD_TRAPPED:
+        return (si->si_status & 0xff) << 8 | 0x7f;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Wait for a process through its pidfd
+ *
+ * The glibc wrapper of waitid has no rusage argument, the system call has.
+ *
+ * @param fd The pidfd
+ * @param si Receives what happened to the process
+ * @param options WEXITED, WSTOPPED and WNOHANG
+ * @param ru Receives the resource usage of an exited process
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int pidfd_wait(int fd, siginfo_t *si, int options, struct rusage *ru) {
+    memset(si, 0, sizeof(*si));
+    memset(ru, 0, sizeof(*ru));
+    return (int)syscall(SYS_waitid, P_PIDFD, fd, si, options, ru);
+}
+
+/**
+ * @brief Add the resource usage of a process to the usage of its job
+ *
+ * @param sum The usage of the job
+ * @param ru The usage of the process
+ */
+static void rusage_add(struct rusage *sum, const struct rusage *ru) {
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    // Processes of a pipeline run side by side, the largest is what counts
+    if (ru->ru_maxrss > sum->ru_maxrss) sum->ru_maxrss = ru->ru_maxrss;
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/**
+ * @brief Record that a process of a job was reaped
+ *
+ * @param slot The slot of the job
+ * @param pid The process that was reaped
+ * @param status Its wait status
+ * @param ru Its resource usage, NULL if it is not known
+ */
+static void process_reaped(int slot, pid_t pid, int status, const struct rusage *ru) {
+    struct job *job = &jobs[slot];
+
+    if (ru) rusage_add(&job->usage.rusage, ru);
+    bool this_line = job->usage.started.tv_sec > line_start.tv_sec ||
+                     (job->usage.started.tv_sec == line_start.tv_sec &&
+                      job->usage.started.tv_nsec >= line_start.tv_nsec);
+    if (ru && this_line) rusage_add(&line_usage, ru);
+
+    int i = process_index(job, pid);
+    if (i >= 0) pidfd_untrack(job, i);
+    slot_index_remove(&pid_index, pid);
+    num_live_pids--;
+    if (pid == job->pids[job->num_pids - 1]) {
+        job->status = status;
+    }
+    if (--job->live_pids == 0) {
+        job->is_done = true;
+        clock_gettime(CLOCK_MONOTONIC, &job->usage.finished);
+    }
+}
+
+/**
+ * @brief Check whether a process of a job has not been reaped yet
+ *
+ * @param slot The slot of the job
+ * @param pid The process
+ * @return true if the process is still live
+ */
+static bool process_is_live(int slot, pid_t pid) {
+    return slot_index_get(&pid_index, pid) == slot;
+}
+
+/**
+ * @brief Convert a wait status to a shell exit status
+ *
+ * @param status The wait status
+ * @return int The exit code, or 128 plus the signal number
+ */
+static int exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return 1;
+}
+
+/**
+ * @brief Seconds in a timeval
+ *
+ * @param tv The timeval
+ * @return double The seconds
+ */
+static double timeval_seconds(struct timeval tv) {
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+/**
+ * @brief Wall clock time a job has been running, up to now if it has not
+ * finished
+ *
+ * @param usage The usage of the job
+ * @return double The seconds
+ */
+static double job_real_seconds(const struct job_usage *usage) {
+    struct timespec end = usage->finished;
+    if (end.tv_sec == 0 && end.tv_nsec == 0) clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - usage->started.tv_sec) +
+           (double)(end.tv_nsec - usage->started.tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Print the times and peak memory of a job
+ *
+ * @param out Stream to print to
+ * @param usage The usage of the job
+ */
+static void print_times(FILE *out, const struct job_usage *usage) {
+    fprintf(out, "real %.2fs user %.2fs sys %.2fs maxrss %ldk",
+            job_real_seconds(usage), timeval_seconds(usage->rusage.ru_utime),
+            timeval_seconds(usage->rusage.ru_stime), usage->rusage.ru_maxrss);
+}
+
+/**
+ * @brief Print the notification for a job that finished
+ *
+ * @param out Stream to print to
+ * @param job The job
+ */
+static void print_done(FILE *out, const struct job *job) {
+    fprintf(out, "[%d] Done %s (", job->job_id, job->command);
+    print_times(out, &job->usage);
+    fprintf(out, ")\n");
+}
+
+/**
+ * @brief Release a slot, keeping its buffers for the next job
+ *
+ * @param slot The slot of a live job
+ */
+static void release_slot(int slot) {
+    struct job *job = &jobs[slot];
+
+    slot_index_remove(&id_index, job->job_id);
+    for (int i = 0; i < job->num_pids; i++) {
+        if (process_is_live(slot, job->pids[i])) {
+            pidfd_untrack(job, i);
+            slot_index_remove(&pid_index, job->pids[i]);
+            num_live_pids--;
+        }
+    }
+
+    if (job->prev != NO_SLOT) jobs[job->prev].next = job->next;
+    else live_head = job->next;
+    if (job->next != NO_SLOT) jobs[job->next].prev = job->prev;
+    else live_tail = job->prev;
+
+    job->job_id = 0;
+    job->pid = 0;
+    job->num_pids = 0;
+    job->live_pids = 0;
+    job->is_background = false;
+    job->is_stopped = false;
+    job->is_done = false;
+    job->prev = NO_SLOT;
+    job->next = free_head;
+    free_head = slot;
+}
+
+/**
+ * @brief Reap every exited child into the ring
+ *
+ * This function is async signal safe. If the ring fills up the remaining
+ * children are left for update_job_status to collect.
+ */
+static void reap_children(void) {
+    int saved_errno = errno;
+    int start = reaped_tail;
+    for (;;) {
+        int next = (reaped_tail + 1) % REAP_RING_SIZE;
+        if (next == reaped_head) {
+            reaped_overflow = 1;
+            break;
+        }
+        int status;
+        pid_t pid = wait4(-1, &status, WNOHANG, &reaped_usage[reaped_tail]);
+        if (pid <= 0) break;
+        reaped_pids[reaped_tail] = pid;
+        reaped_status[reaped_tail] = status;
+        reaped_tail = next;
+    }
+    // Wake up an event loop waiting for input, a full pipe is awake already
+    if ((reaped_tail != start || reaped_overflow) && notify_pipe[1] >= 0) {
+        ssize_t rval = write(notify_pipe[1], "", 1);
+        UNUSED(rval)
+    }
+    errno = saved_errno;
+}
+
+/**
+ * @brief SIGCHLD handler
+ *
+ * @param sig The signal number
+ */
+static void sigchld_handler(int sig) {
+    UNUSED(sig)
+    reap_children();
+}
+
+/**
+ * @brief Record a reaped process and report its job if it finished
+ *
+ * @param pid The process
+ * @param status Its wait status
+ * @param ru Its resource usage, NULL if it is not known
+ * @param notify Print a notification if the job finished
+ */
+static void collect_process(pid_t pid, int status, const struct rusage *ru, bool notify) {
+    int slot = slot_index_get(&pid_index, pid);
+    if (slot == NO_SLOT) return;
+    process_reaped(slot, pid, status, ru);
+    if (notify && jobs[slot].is_done) {
+        print_done(stdout, &jobs[slot]);
+        release_slot(slot);
+    }
+}
+
+/**
+ * @brief Collect the processes whose pidfd reported that they exited, and
+ * poll the processes that have no pidfd
+ *
+ * @param notify Print a notification for every job that finished
+ */
+static void collect_pidfds(bool notify) {
+    struct epoll_event events[PIDFD_EVENTS];
+    int n;
+    do {
+        n = epoll_wait(pidfd_epoll, events, PIDFD_EVENTS, 0);
+        for (int e = 0; e < n; e++) {
+            pid_t pid = (pid_t)events[e].data.u64;
+            int slot = slot_index_get(&pid_index, pid);
+            int i = slot != NO_SLOT ? process_index(&jobs[slot], pid) : -1;
+            if (i < 0 || jobs[slot].pidfds[i] < 0) continue;
+
+            siginfo_t si;
+            struct rusage ru;
+            int rval = pidfd_wait(jobs[slot].pidfds[i], &si, WEXITED | WNOHANG, &ru);
+            if (rval == 0 && si.si_pid == 0) continue;  // Not exited after all
+            // Somebody else reaped it when waitid fails, there is no status
+            if (rval == 0) collect_process(pid, siginfo_status(&si), &ru, notify);
+            else collect_process(pid, 0, NULL, notify);
+        }
+    } while (n == PIDFD_EVENTS);
+
+    for (int slot = live_head; num_polled > 0 && slot != NO_SLOT;) {
+        struct job *job = &jobs[slot];
+        int next = job->next;
+        for (int i = 0; i < job->num_pids && slot_index_get(&id_index, job->job_id) == slot; i++) {
+            int status;
+            struct rusage ru;
+            if (job->pidfds[i] == PIDFD_POLLED &&
+                wait4(job->pids[i], &status, WNOHANG, &ru) == job->pids[i]) {
+                collect_process(job->pids[i], status, &ru, notify);
+            }
+        }
+        slot = next;
+    }
+}
+
+/**
+ * @brief Mark the jobs of all reaped children as done
+ *
+ * @param notify Print a notification for every job that finished
+ */
+static void collect_reaped(bool notify) {
+    if (use_pidfd) {
+        collect_pidfds(notify);
+        return;
+    }
+
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    char drain[64];
+    while (notify_pipe[0] >= 0 && read(notify_pipe[0], drain, sizeof(drain)) > 0) {
+        continue;
+    }
+    for (;;) {
+        while (reaped_head != reaped_tail) {
+            collect_process(reaped_pids[reaped_head], reaped_status[reaped_head],
+                            &reaped_usage[reaped_head], notify);
+            reaped_head = (reaped_head + 1) % REAP_RING_SIZE;
+        }
+        if (!reaped_overflow) break;
+        // The handler ran out of room, collect what it left behind
+        reaped_overflow = 0;
+        reap_children();
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * @brief Initialize the job table
+ *
+ * This function empties the job table and sets up child tracking: the
+ * epoll set for pidfds when the kernel has them, otherwise the SIGCHLD
+ * handler that reaps finished jobs and the pipe it writes to. Both are
+ * created once and kept open.
+ */
+void initialize_jobs() {
+    destroy_jobs();
+
+    if (pidfd_epoll < 0 && reap_mode == REAP_AUTO) {
+        int probe = (int)syscall(SYS_pidfd_open, getpid(), 0);
+        if (probe >= 0) {
+            close(probe);
+            pidfd_epoll = epoll_create1(EPOLL_CLOEXEC);
+        }
+    }
+    use_pidfd = pidfd_epoll >= 0 && reap_mode == REAP_AUTO;
+    if (use_pidfd) {
+        // Nothing may reap our children behind the pidfds' back
+        signal(SIGCHLD, SIG_DFL);
+        return;
+    }
+
+    if (notify_pipe[0] < 0 && pipe2(notify_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        notify_pipe[0] = notify_pipe[1] = -1;
+    }
+
+    struct sigaction sa;
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+/**
+ * @brief Select how children are reaped
+ *
+ * @param mode The reaping strategy, used by the next initialize_jobs
+ */
+void set_reap_mode(enum reap_mode mode) {
+    reap_mode = mode;
+}
+
+/**
+ * @brief Descriptor that becomes readable when a child exits
+ *
+ * @return int The epoll set of the pidfds, or the read end of the
+ * notification pipe without pidfds, -1 if there is none
+ */
+int jobs_notify_fd(void) {
+    return use_pidfd ? pidfd_epoll : notify_pipe[0];
+}
+
+/**
+ * @brief Check whether exited children are waiting to be looked at
+ *
+ * @return true if update_job_status may have jobs to report
+ */
+bool jobs_reaped_pending(void) {
+    if (use_pidfd) {
+        struct epoll_event ev;
+        return epoll_wait(pidfd_epoll, &ev, 1, 0) > 0;
+    }
+    return reaped_head != reaped_tail || reaped_overflow;
+}
+
+/**
+ * @brief Free all memory held by the job table
+ */
+void destroy_jobs() {
+    for (int i = 0; i < jobs_size; i++) {
+        for (int p = 0; jobs[i].job_id != 0 && p < jobs[i].num_pids; p++) {
+            if (process_is_live(i, jobs[i].pids[p])) pidfd_untrack(&jobs[i], p);
+        }
+        free(jobs[i].command);
+        free(jobs[i].pids);
+        free(jobs[i].pidfds);
+    }
+    free(jobs);
+    free(id_index.keys);
+    free(id_index.slots);
+    free(pid_index.keys);
+    free(pid_index.slots);
+    memset(&id_index, 0, sizeof(id_index));
+    memset(&pid_index, 0, sizeof(pid_index));
+    jobs = NULL;
+    jobs_size = 0;
+    num_live_pids = 0;
+    free_head = NO_SLOT;
+    live_head = NO_SLOT;
+    live_tail = NO_SLOT;
+}
+
+/**
+ * @brief Add a new job to the job table
+ *
+ * @param pid Process ID of the new job
+ * @param command Command string of the job
+ * @param is_background Flag indicating if it's a background job
+ * @return int Job ID of the newly added job, or -1 if out of memory
+ */
+int add_job(pid_t pid, char *command, bool is_background) {
+    return add_pipeline_job(&pid, 1, command, is_background);
+}
+
+/**
+ * @brief Add a pipeline as a single job to the job table
+ *
+ * @param pids Processes of the pipeline, pids[0] leads the process group
+ * @param count Number of processes
+ * @param command Command string of the job
+ * @param is_background Flag indicating if it's a background job
+ * @return int Job ID of the newly added job, or -1 if out of memory
+ */
+int add_pipeline_job(const pid_t *pids, int count, char *command, bool is_background) {
+    if (count <= 0) return -1;
+    if (free_head == NO_SLOT && grow_jobs() != 0) {
+        return -1;
+    }
+    if (reserve_pids(count) != 0) {
+        return -1;
+    }
+
+    int slot = free_head;
+    struct job *job = &jobs[slot];
+
+    // Slots keep their buffers so steady state job churn does not allocate
+    size_t size = strlen(command) + 1;
+    if (size > job->command_size) {
+        char *buf = realloc(job->command, size);
+        if (!buf) return -1;
+        job->command = buf;
+        job->command_size = size;
+    }
+    memcpy(job->command, command, size);
+    if (count > job->pids_size) {
+        pid_t *buf = realloc(job->pids, (size_t)count * sizeof(pid_t));
+        if (!buf) return -1;
+        job->pids = buf;
+        int *fds = realloc(job->pidfds, (size_t)count * sizeof(int));
+        if (!fds) return -1;
+        job->pidfds = fds;
+        job->pids_size = count;
+    }
+    memcpy(job->pids, pids, (size_t)count * sizeof(pid_t));
+
+    // Like bash, a new job gets the number after the highest one in use
+    free_head = job->next;
+    job->job_id = live_tail != NO_SLOT ? jobs[live_tail].job_id + 1 : 1;
+    job->pid = pids[0];
+    job->num_pids = count;
+    job->live_pids = count;
+    job->status = 0;
+    job->is_background = is_background;
+    job->is_stopped = false;
+    job->is_done = false;
+    memset(&job->usage, 0, sizeof(job->usage));
+    clock_gettime(CLOCK_MONOTONIC, &job->usage.started);
+
+    // Ids only grow, so appending keeps the live list in id order
+    job->prev = live_tail;
+    job->next = NO_SLOT;
+    if (live_tail != NO_SLOT) jobs[live_tail].next = slot;
+    else live_head = slot;
+    live_tail = slot;
+
+    slot_index_put(&id_index, job->job_id, slot);
+    for (int i = 0; i < count; i++) {
+        slot_index_put(&pid_index, pids[i], slot);
+        pidfd_track(job, i);
+    }
+    num_live_pids += count;
+    return job->job_id;
+}
+
+/**
+ * @brief Remove a job from the job table
+ *
+ * @param job_id ID of the job to be removed
+ */
+void remove_job(int job_id) {
+    int slot = slot_index_get(&id_index, job_id);
+    if (slot != NO_SLOT) {
+        release_slot(slot);
+    }
+}
+
+/**
+ * @brief Wait for a foreground job
+ *
+ * This function waits until every process of the job has exited or the
+ * job is stopped. A finished job is removed from the table, a stopped one
+ * stays in it as a background job.
+ *
+ * @param job_id ID of the job
+ * @return int Exit status of the last process of the pipeline
+ */
+int wait_for_job(int job_id) {
+    int slot = slot_index_get(&id_index, job_id);
+    if (slot == NO_SLOT) return -1;
+
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+
+    struct job *job = &jobs[slot];
+    int stop_status = 0;
+    memset(&last_usage, 0, sizeof(last_usage));
+    for (int i = 0; i < job->num_pids; i++) {
+        pid_t pid = job->pids[i];
+        if (!process_is_live(slot, pid)) continue;
+
+        int status;
+        pid_t rval;
+        struct rusage ru;
+        if (job->pidfds[i] >= 0) {
+            siginfo_t si;
+            do {
+                rval = pidfd_wait(job->pidfds[i], &si, WEXITED | WSTOPPED, &ru);
+            } while (rval < 0 && errno == EINTR);
+            status = siginfo_status(&si);
+        } else {
+            do {
+                rval = wait4(pid, &status, WUNTRACED, &ru);
+            } while (rval < 0 && errno == EINTR);
+        }
+
+        if (rval < 0) {
+            // Somebody else reaped it, there is no status to report
+            process_reaped(slot, pid, 0, NULL);
+        } else if (WIFSTOPPED(status)) {
+            stop_status = status;
+        } else {
+            process_reaped(slot, pid, status, &ru);
+        }
+    }
+
+    int rval;
+    if (job->is_done) {
+        rval = exit_code(job->status);
+        last_usage = job->usage;
+        release_slot(slot);
+    } else {
+        job->is_stopped = true;
+        job->is_background = true;
+        printf("\n[%d] Stopped %s\n", job->job_id, job->command);
+        rval = exit_code(stop_status);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return rval;
+}
+
+/**
+ * @brief Wait until one of several background jobs finishes
+ *
+ * The wait sleeps on jobs_notify_fd, so it only wakes up when a child
+ * exits. Other jobs that finish meanwhile are marked done and reported by
+ * the next jobs builtin.
+ *
+ * @param job_ids The IDs of the jobs, entries that are 0 are skipped
+ * @param count The number of entries
+ * @param status Receives the exit status of the job that finished
+ * @return int Index of the finished job in job_ids, which is removed from
+ * the job table, or -1 if none of the jobs exist
+ */
+int wait_for_any_job(const int *job_ids, int count, int *status) {
+    for (;;) {
+        collect_reaped(false);
+
+        bool waiting = false;
+        for (int i = 0; i < count; i++) {
+            if (job_ids[i] == 0) continue;
+            int slot = slot_index_get(&id_index, job_ids[i]);
+            if (slot == NO_SLOT) continue;
+            if (jobs[slot].is_done) {
+                *status = exit_code(jobs[slot].status);
+                release_slot(slot);
+                return i;
+            }
+            waiting = true;
+        }
+        if (!waiting) return -1;
+
+        // SIGCHLD may be blocked by a caller, the handler has to run
+        sigset_t mask;
+        sigprocmask(SIG_BLOCK, NULL, &mask);
+        sigdelset(&mask, SIGCHLD);
+        struct pollfd pfd = { .fd = jobs_notify_fd(), .events = POLLIN };
+        struct timespec timeout = { 0, POLLED_WAIT_MS * 1000000L };
+        bool polled = num_polled > 0 || pfd.fd < 0;
+        ppoll(&pfd, pfd.fd >= 0, polled ? &timeout : NULL, &mask);
+    }
+}
+
+/**
+ * @brief Update the status of all jobs
+ *
+ * This function reaps the processes whose pidfds report that they exited,
+ * or takes the ones the SIGCHLD handler reaped, and reports and removes
+ * the jobs that finished. Only finished jobs are
+ * visited.
+ */
+void update_job_status() {
+    STATS_MEASURE(STAT_JOBS, collect_reaped(true));
+}
+
+/**
+ * @brief Remove the finished jobs without reporting them
+ */
+void prune_jobs(void) {
+    collect_reaped(false);
+
+    int slot = live_head;
+    while (slot != NO_SLOT) {
+        int next = jobs[slot].next;
+        if (jobs[slot].is_done) release_slot(slot);
+        slot = next;
+    }
+}
+
+/**
+ * @brief Print all jobs
+ *
+ * This function prints the status of all jobs in the job table. Finished
+ * jobs are reported once and then removed.
+ *
+ * @param out Stream to print to
+ * @param long_format Follow every job with the resources it used so far
+ */
+static void print_job_table(FILE *out, bool long_format) {
+    collect_reaped(false);
+
+    int slot = live_head;
+    while (slot != NO_SLOT) {
+        struct job *job = &jobs[slot];
+        int next = job->next;
+        if (job->is_done) {
+            print_done(out, job);
+        } else if (job->is_stopped) {
+            fprintf(out, "[%d] %d Stopped %s\n", job->job_id, job->pid, job->command);
+        } else {
+            fprintf(out, "[%d] %d Running %s\n", job->job_id, job->pid, job->command);
+        }
+        if (long_format) {
+            const struct rusage *ru = &job->usage.rusage;
+            fprintf(out, "    ");
+            print_times(out, &job->usage);
+            fprintf(out, " faults %ld/%ld ctxsw %ld/%ld\n", ru->ru_minflt, ru->ru_majflt,
+                    ru->ru_nvcsw, ru->ru_nivcsw);
+        }
+        if (job->is_done) release_slot(slot);
+        slot = next;
+    }
+}
+
+/**
+ * @brief Print all jobs
+ *
+ * @param out Stream to print to
+ */
+void print_jobs(FILE *out) {
+    print_job_table(out, false);
+}
+
+/**
+ * @brief Print all jobs with the resources they used
+ *
+ * @param out Stream to print to
+ */
+void print_jobs_long(FILE *out) {
+    print_job_table(out, true);
+}
+
+/**
+ * @brief Resources used by the last foreground job that finished
+ *
+ * @param usage Receives the usage, all zero if no job finished yet or the
+ * last job waited for was stopped
+ */
+void job_last_usage(struct job_usage *usage) {
+    *usage = last_usage;
+}
+
+/**
+ * @brief Start summing the usage of the jobs of a new command line
+ */
+void jobs_line_reset(void) {
+    clock_gettime(CLOCK_MONOTONIC, &line_start);
+    memset(&line_usage, 0, sizeof(line_usage));
+}
+
+/**
+ * @brief Resources used by the jobs of the current command line
+ *
+ * @param ru Receives the usage of their processes reaped so far
+ */
+void jobs_line_usage(struct rusage *ru) {
+    *ru = line_usage;
+}
@@ -21,185 +21,200 @@
 #include <pwd.h>
 #include <readline/history.h>
 #include <sys/wait.h>
-#include <dirent.h>
 #include "lab.h"
 #include <getopt.h> 
 
-#define MAX_JOBS 100 // Maximum number of jobs that can be managed
-
-/**
- * @brief Structure to represent a job in the shell
- */
-struct job {
-    int job_id;         // Unique identifier for the job
-    pid_t pid;          // Process ID of the job
-    char *command;      // Command string of the job
-    bool is_background; // Flag to indicate if it's a background job
-    bool is_done;       // Flag to indicate if the job is completed
-};
-
-struct job jobs[MAX_JOBS];  // Array to store all jobs
-int next_job_id = 1;        // Counter for assigning job IDs
-
 /**
- * @brief Initialize the jobs array
+ * @brief Get the shell prompt
+ *
+ * This function returns the shell prompt, either from an environment variable
+ * or a default value.
  *
- * This function sets up the jobs array with default values.
+ * @param env Name of the environment variable to check for custom prompt
+ * @return char* The shell prompt string
  */
-void initialize_jobs() {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        jobs[i].job_id = 0;
-        jobs[i].pid = 0;
-        jobs[i].command = NULL;
-        jobs[i].is_background = false;
-        jobs[i].is_done = false;
+char *get_prompt(const char *env) {
+    char* custom_prompt = getenv(env);
+    if (custom_prompt != NULL) {
+        return strdup(custom_prompt);
     }
+    return strdup("shell>");
 }
 
 /**
- * @brief Add a new job to the jobs array
+ * @brief Length of the operator at p
  *
- * @param pid Process ID of the new job
- * @param command Command string of the job
- * @param is_background Flag indicating if it's a background job
- * @return int Job ID of the newly added job, or -1 if no space available
+ * Besides | and & the operators are the redirections <, >, >>, <&, >& and
+ * <<<. At the start of a word a redirection may be preceded by the number
+ * of the descriptor it applies to, as in 2>&1.
+ *
+ * @param p Start of the text to check
+ * @param end End of the text
+ * @param word_start p is at the start of a word
+ * @return size_t Number of bytes in the operator, 0 if p is not an operator
  */
-int add_job(pid_t pid, char *command, bool is_background) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].job_id == 0) {
-            jobs[i].job_id = next_job_id++;
-            jobs[i].pid = pid;
-            jobs[i].command = strdup(command);
-            jobs[i].is_background = is_background;
-            jobs[i].is_done = false;
-            return jobs[i].job_id;
-        }
+static size_t operator_length(const char *p, const char *end, bool word_start) {
+    const char *q = p;
+    if (word_start) {
+        while (q < end && *q >= '0' && *q <= '9') q++;
     }
-    return -1; // No space for new job
-}
 
-/**
- * @brief Remove a job from the jobs array
- *
- * @param job_id ID of the job to be removed
- */
-void remove_job(int job_id) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].job_id == job_id) {
-            free(jobs[i].command);
-            jobs[i].job_id = 0;
-            jobs[i].pid = 0;
-            jobs[i].command = NULL;
-            jobs[i].is_background = false;
-            jobs[i].is_done = false;
-            break;
+    if (q < end && (*q == '<' || *q == '>')) {
+        size_t n = 1;
+        if (q + 1 < end && (q[1] == '&' || (q[1] == '>' && *q == '>'))) {
+            n = 2;
+        } else if (*q == '<' && q + 2 < end && q[1] == '<' && q[2] == '<') {
+            n = 3;
         }
+        return (size_t)(q - p) + n;
     }
+    if (q != p) return 0;
+    return (*p == '|' || *p == '&') ? 1 : 0;
 }
 
 /**
- * @brief Update the status of all jobs
+ * @brief Check whether a token is an operator
  *
- * This function checks the status of all jobs and updates them accordingly.
+ * @param token The token
+ * @return true if the whole token is one operator
  */
-void update_job_status() {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].job_id != 0 && !jobs[i].is_done) {
-            int status;
-            pid_t result = waitpid(jobs[i].pid, &status, WNOHANG);
-            if (result == jobs[i].pid) {
-                jobs[i].is_done = true;
-                printf("[%d] Done %s\n", jobs[i].job_id, jobs[i].command);
-            }
-        }
-    }
+bool is_operator(const char *token) {
+    size_t len = strlen(token);
+    return len > 0 && operator_length(token, token + len, true) == len;
 }
 
 /**
- * @brief Print all jobs
+ * @brief Check whether a line contains a byte that starts an operator
  *
- * This function prints the status of all jobs in the jobs array.
+ * @param line The command line, it does not need a terminator
+ * @param length Length of the line
+ * @return true if the line may contain an operator
  */
-void print_jobs() {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].job_id != 0) {
-            if (jobs[i].is_done) {
-                printf("[%d] Done %s\n", jobs[i].job_id, jobs[i].command);
-            } else {
-                printf("[%d] %d Running %s\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
-            }
-        }
-    }
+static bool has_operator_char(const char *line, size_t length) {
+    return memchr(line, '|', length) || memchr(line, '&', length) ||
+           memchr(line, '<', length) || memchr(line, '>', length);
 }
 
 /**
- * @brief Get the shell prompt
+ * @brief Split a line that contains operators into arguments
  *
- * This function returns the shell prompt, either from an environment variable
- * or a default value.
+ * Operators become arguments of their own even when they touch a word, so
+ * every argument is copied into buf with its own terminator.
  *
- * @param env Name of the environment variable to check for custom prompt
- * @return char* The shell prompt string
+ * @param line The command line
+ * @param length Length of the line
+ * @param tokens Receives the arguments, or NULL to only count them
+ * @param buf Receives the argument strings, it must have room for length
+ * plus one byte per argument
+ * @return size_t Number of arguments
  */
-char *get_prompt(const char *env) {
-    char* custom_prompt = getenv(env);
-    if (custom_prompt != NULL) {
-        return strdup(custom_prompt);
+static size_t split_operators(const char *line, size_t length, char **tokens, char *buf) {
+    const char *end = line + length;
+    size_t count = 0;
+
+    for (const char *p = scan_skip(SCAN_ARG_DELIMS, line, end); p < end;
+         p = scan_skip(SCAN_ARG_DELIMS, p, end)) {
+        size_t n = operator_length(p, end, true);
+        if (n == 0) {
+            const char *word_end = scan_find(SCAN_ARG_DELIMS, p, end);
+            while (p + n < word_end && operator_length(p + n, word_end, false) == 0) n++;
+        }
+        if (tokens) {
+            memcpy(buf, p, n);
+            buf[n] = '\0';
+            tokens[count] = buf;
+            buf += n + 1;
+        }
+        count++;
+        p += n;
     }
-    return strdup("shell>");
+    return count;
 }
 
 /**
- * @brief Parse a command line into an array of arguments
+ * @brief Parse a command line into a block from the arena or the heap
  *
- * @param line The command line to parse
+ * The line is scanned once to count the arguments so the pointer array and
+ * a copy of the line can be allocated as a single exactly sized block. The
+ * second scan terminates each argument in place in that copy. Both scans
+ * use the vectorized classifiers in scan.c. Lines that contain operators
+ * take a slower path that copies each argument. No state is kept between
+ * calls, so the function is safe to use from several threads.
+ *
+ * @param a Arena to allocate from, or NULL to use malloc
+ * @param line The command line to parse, it does not need a terminator
+ * @param line_length Length of the line
  * @return char** Array of parsed arguments
  */
-char **cmd_parse(const char *line) {
+static char **cmd_parse_block(struct arena *a, const char *line, size_t line_length) {
     if (line == NULL) return NULL;
 
-    int bufsize = 64; // Initial buffer size for tokens
-    int position = 0;
-    char **tokens;
+    bool has_operators = has_operator_char(line, line_length);
+    size_t count = has_operators ? split_operators(line, line_length, NULL, NULL)
+                                 : scan_count_tokens(SCAN_ARG_DELIMS, line, line_length);
 
-    size_t line_length = strlen(line) + 1;
-    size_t total_size = bufsize * sizeof(char*) + line_length * sizeof(char);
-
-    tokens = malloc(total_size);
+    size_t string_size = line_length + 1 + (has_operators ? count : 0);
+    size_t total_size = (count + 1) * sizeof(char*) + string_size;
+    char **tokens = a ? arena_alloc(a, total_size) : malloc(total_size);
     if (!tokens) {
         fprintf(stderr, "allocation error\n");
         exit(EXIT_FAILURE);
     }
 
     // The buffer where the tokens will point into
-    char *buffer = (char *)(tokens + bufsize);
-    strcpy(buffer, line);
-
-    char *token = strtok(buffer, " \t\r\n\a");
-    while (token != NULL) {
-        tokens[position] = token;
-        position++;
-
-        if (position >= bufsize) {
-            // Need to reallocate tokens and adjust buffer pointer
-            bufsize += 64;
-            total_size = bufsize * sizeof(char*) + line_length * sizeof(char);
-            tokens = realloc(tokens, total_size);
-            if (!tokens) {
-                fprintf(stderr, "allocation error\n");
-                exit(EXIT_FAILURE);
-            }
-            buffer = (char *)(tokens + bufsize);
-            // No need to copy buffer again; it's already in place
-        }
-
-        token = strtok(NULL, " \t\r\n\a");
+    char *buffer = (char *)(tokens + count + 1);
+    size_t position;
+    if (has_operators) {
+        position = split_operators(line, line_length, tokens, buffer);
+    } else {
+        memcpy(buffer, line, line_length);
+        buffer[line_length] = '\0';
+        position = scan_split(SCAN_ARG_DELIMS, buffer, line_length, tokens);
     }
     tokens[position] = NULL;
 
     return tokens;
 }
 
+/**
+ * @brief Parse a command line into an array of arguments
+ *
+ * @param line The command line to parse
+ * @return char** Array of parsed arguments
+ */
+char **cmd_parse(const char *line) {
+    char **argv;
+    STATS_MEASURE(STAT_PARSE, argv = cmd_parse_block(NULL, line, line ? strlen(line) : 0));
+    return argv;
+}
+
+/**
+ * @brief Parse a command line into an array of arguments from an arena
+ *
+ * @param a The arena to allocate from
+ * @param line The command line to parse
+ * @return char** Array of parsed arguments
+ */
+char **cmd_parse_arena(struct arena *a, const char *line) {
+    char **argv;
+    STATS_MEASURE(STAT_PARSE, argv = cmd_parse_block(a, line, line ? strlen(line) : 0));
+    return argv;
+}
+
+/**
+ * @brief Parse part of a larger buffer into an array of arguments
+ *
+ * @param a The arena to allocate from
+ * @param line Start of the command line, it does not need a terminator
+ * @param len Length of the command line
+ * @return char** Array of parsed arguments
+ */
+char **cmd_parse_view(struct arena *a, const char *line, size_t len) {
+    char **argv;
+    STATS_MEASURE(STAT_PARSE, argv = cmd_parse_block(a, line, len));
+    return argv;
+}
+
 /**
  * @brief Free the memory allocated by cmd_parse
  *
@@ -221,148 +236,97 @@ void cmd_free(char **tokens) {
 char *trim_white(char *line) {
     if (line == NULL) return NULL;
 
-    // Trim leading space
-    while(isspace((unsigned char)*line)) line++;
-
-    if(*line == 0)  // will be true if original string was composed entirely of spaces
-        return line;
+    char *end = line + strlen(line);
 
-    // Trim trailing space
-    char *end = line + strlen(line) - 1;
-    while(end > line && isspace((unsigned char)*end)) end--;
+    // Trim leading space
+    line = (char *)scan_skip(SCAN_SPACE, line, end);
 
-    // Write new null terminator character
-    end[1] = '\0';
+    // Trim trailing space and write new null terminator character
+    end = (char *)scan_rskip(SCAN_SPACE, line, end);
+    *end = '\0';
 
     return line;
 }
 
 
 /**
- * @brief Handle built-in shell commands
- *
- * This function checks if a command is built-in and executes it if so.
+ * @brief Run a command that is a lone builtin
  *
  * @param sh Pointer to the shell structure
  * @param argv Array of command arguments
+ * @param status Receives the exit status of the builtin, may be NULL
  * @return true if the command was a built-in command, false otherwise
  */
-bool do_builtin(struct shell *sh, char **argv) {
+static bool run_lone_builtin(struct shell *sh, char **argv, int *status) {
     if (argv == NULL || argv[0] == NULL) return false;
 
-    if (strcmp(argv[0], "exit") == 0) {
-        sh_destroy(sh);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(argv[0], "cd") == 0) {
-        change_dir(argv);
-        return true;
-    } else if (strcmp(argv[0], "history") == 0) {
-        print_history();
-        return true;
-    } else if (strcmp(argv[0], "pwd") == 0) {
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) != NULL) {
-            printf("%s\n", cwd);
-        } else {
-            perror("getcwd() error");
-        }
-        return true;
-    } else if (strcmp(argv[0], "ls") == 0 && argv[1] == NULL) {
-        // Only handle 'ls' without arguments as a built-in command
-        DIR *d;
-        struct dirent *dir;
-        d = opendir(".");
-        if (d) {
-            while ((dir = readdir(d)) != NULL) {
-                if (dir->d_name[0] != '.') {
-                    printf("%s\n", dir->d_name);
-                }
-            }
-            closedir(d);
-        } else {
-            perror("opendir() error");
-        }
-        return true;
-    } else if (strcmp(argv[0], "jobs") == 0) {
-        print_jobs();
-        return true;
+    const struct builtin *b = builtin_lookup(argv[0]);
+    for (int i = 0; !(b && b->flags & BUILTIN_KEYWORD) && argv[i] != NULL; i++) {
+        if (is_operator(argv[i])) return false;
     }
-
-    return false;  // Not a builtin command
+    bool ran;
+    STATS_MEASURE(STAT_BUILTIN, ran = builtin_run(sh, argv, stdout, status));
+    return ran;
 }
 
 /**
- * @brief Execute a command
+ * @brief Handle built-in shell commands
  *
- * This function forks a new process to execute the given command.
+ * This function checks if a command is built-in and executes it if so.
+ * Pipelines, background jobs and redirections are left to
+ * execute_command, which runs the builtin inside the shell when it can.
  *
- * @param argv Array of command arguments
  * @param sh Pointer to the shell structure
- * @return int Status of the command execution
+ * @param argv Array of command arguments
+ * @return true if the command was a built-in command, false otherwise
  */
-int execute_command(char **argv, struct shell *sh) {
-    if (argv == NULL || argv[0] == NULL) {
-        return 1;
-    }
+bool do_builtin(struct shell *sh, char **argv) {
+    return run_lone_builtin(sh, argv, NULL);
+}
 
-    // Check if it's a background process
-    bool is_background = false;
-    int i;
-    for (i = 0; argv[i] != NULL; i++) {
-        if (strcmp(argv[i], "&") == 0 || (strlen(argv[i]) > 0 && argv[i][strlen(argv[i])-1] == '&')) {
-            is_background = true;
-            if (strcmp(argv[i], "&") == 0) {
-                argv[i] = NULL;  // Remove the '&' from the arguments
-            } else {
-                argv[i][strlen(argv[i])-1] = '\0';  // Remove the '&' from the end of the command
-            }
-            break;
-        }
-    }
+/**
+ * @brief Run one line of input
+ *
+ * @param sh Pointer to the shell structure
+ * @param line The line
+ * @return int Exit status of the command
+ */
+int sh_eval(struct shell *sh, char *line) {
+    return sh_eval_view(sh, line, strlen(line));
+}
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        if (!is_background) {
-            // Set the process group ID only for foreground processes
-            setpgid(0, 0);
-            tcsetpgrp(sh->shell_terminal, getpid());
-        }
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        
-        if (execvp(argv[0], argv) == -1) {
-            perror("shell");
-            exit(EXIT_FAILURE);
-        }
-    } else if (pid < 0) {
-        perror("shell");
-    } else {
-        // Parent process
-        if (!is_background) {
-            int status;
-            setpgid(pid, pid);
-            tcsetpgrp(sh->shell_terminal, pid);
-            waitpid(pid, &status, WUNTRACED);
-            tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
-        } else {
-            // Background process
-            setpgid(pid, pid);
-            char command[1024] = "";
-            for (int j = 0; argv[j] != NULL; j++) {
-                strcat(command, argv[j]);
-                strcat(command, " ");
-            }
-            strcat(command, "&");
-            int job_id = add_job(pid, command, true);
-            printf("[%d] %d %s\n", job_id, pid, command);
+/**
+ * @brief Run one line of input that is part of a larger buffer
+ *
+ * @param sh Pointer to the shell structure
+ * @param line Start of the line, it does not need a terminator
+ * @param len Length of the line
+ * @return int Exit status of the command
+ */
+int sh_eval_view(struct shell *sh, const char *line, size_t len) {
+    int status = 0;
+
+    // Nobody reads job notifications in batch mode, the interactive loop
+    // reports them before each prompt
+    if (sh->batch) prune_jobs();
+
+    // Trim without writing, the line may be in a read only mapping
+    const char *end = scan_rskip(SCAN_SPACE, line, line + len);
+    line = scan_skip(SCAN_SPACE, line, end);
+    phase_reset();
+    if (line < end) {
+        // Parse the command line into the per command arena
+        uint64_t start = phase_clock_ns();
+        char **args = cmd_parse_view(&sh->arena, line, (size_t)(end - line));
+        phase_add(PHASE_PARSE, phase_clock_ns() - start);
+        if (!run_lone_builtin(sh, args, &status)) {
+            // Not a built-in command, execute it as an external command
+            status = execute_command(args, sh);
         }
     }
-
-    return 1;
+    // Release everything allocated for this command
+    arena_reset(&sh->arena);
+    return status;
 }
 
 /**
@@ -414,7 +378,7 @@ int change_dir(char **argv) {
  */
 void sh_init(struct shell *sh) {
     sh->shell_terminal = STDIN_FILENO;
-    sh->shell_is_interactive = isatty(sh->shell_terminal);
+    sh->shell_is_interactive = !sh->batch && isatty(sh->shell_terminal);
 
     if (sh->shell_is_interactive) {
         while (tcgetpgrp(sh->shell_terminal) != (sh->shell_pgid = getpgrp()))
@@ -428,14 +392,15 @@ void sh_init(struct shell *sh) {
 
         tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
         tcgetattr(sh->shell_terminal, &sh->shell_tmodes);
-    }
 
-    signal(SIGINT, SIG_IGN);
-    signal(SIGQUIT, SIG_IGN);
-    signal(SIGTSTP, SIG_IGN);
-    signal(SIGTTIN, SIG_IGN);
-    signal(SIGTTOU, SIG_IGN);
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+    }
 
+    arena_init(&sh->arena);
     initialize_jobs();
 }
 
@@ -443,7 +408,9 @@ void sh_init(struct shell *sh) {
  * @brief Destroy the shell and free associated resources
  *
  * This function is responsible for cleaning up resources allocated by the shell.
- * It frees the memory allocated for the shell prompt and clears the command history.
+ * It frees the memory allocated for the shell prompt, the path hash table, the
+ * per command arena and the jobs, closes the persistent history and clears
+ * the session and readline history.
  *
  * @param sh Pointer to the shell structure to be destroyed
  */
@@ -451,24 +418,48 @@ void sh_destroy(struct shell *sh) {
     if (sh->prompt) {
         free(sh->prompt);
     }
+    path_hash_clear();
+    arena_destroy(&sh->arena);
+    destroy_jobs();
+    hist_close();
+    hist_ring_destroy();
     clear_history();  // Clear readline history
 }
 
+/**
+ * @brief Print one entry of the session history
+ *
+ * @param seq Number of the entry
+ * @param line The entry
+ * @param arg Stream to print to
+ */
+static void print_history_entry(uint64_t seq, const char *line, void *arg) {
+    fprintf((FILE *)arg, "%llu: %s\n", (unsigned long long)seq, line);
+}
+
 /**
  * @brief Print the command history
  *
- * This function prints out the entire command history of the shell session.
- * It uses the readline library's history functions to access and display
- * each command in the history list.
+ * This function prints out the command history. Entries come from the
+ * bounded session history when it was created, numbered the way !n refers
+ * to them. Otherwise it uses the readline library's history functions to
+ * access and display each command in the history list.
+ *
+ * @param out Stream to print to
  */
-void print_history() {
+void print_history(FILE *out) {
     HIST_ENTRY **the_history;
     int i;
 
+    if (hist_ring_capacity() > 0) {
+        hist_ring_foreach(print_history_entry, out);
+        return;
+    }
+
     the_history = history_list();
     if (the_history) {
         for (i = 0; the_history[i]; i++) {
-            printf("%d: %s\n", i + history_base, the_history[i]->line);
+            fprintf(out, "%d: %s\n", i + history_base, the_history[i]->line);
         }
     }
 }
@@ -477,23 +468,35 @@ void print_history() {
  * @brief Parse command-line arguments for the shell
  *
  * This function handles the -v command-line argument, which prints
- * the shell version. It uses getopt to parse arguments.
+ * the shell version, -c with a string of commands and a script to run.
+ * It uses getopt to parse arguments.
  *
  * @param argc The number of command-line arguments
  * @param argv An array of strings containing the command-line arguments
+ * @param sh Pointer to the shell structure, receives the batch settings
  * @return bool True if the shell should exit after parsing args, false otherwise
  */
-bool parse_args(int argc, char **argv) {
+bool parse_args(int argc, char **argv, struct shell *sh) {
     int opt;
-    while ((opt = getopt(argc, argv, "v")) != -1) {
+    while ((opt = getopt(argc, argv, "vSc:")) != -1) {
         switch (opt) {
             case 'v':
                 printf("Shell version %d.%d\n", lab_VERSION_MAJOR, lab_VERSION_MINOR);
                 return true;  // Indicate that the shell should exit
+            case 'c':
+                sh->command = optarg;
+                break;
+            case 'S':
+                stats_enabled = true;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-v] [-S] [-c command | script]\n", argv[0]);
                 exit(1);
         }
     }
+    if (sh->command == NULL && optind < argc) {
+        sh->script = argv[optind];
+    }
+    sh->batch = sh->command != NULL || sh->script != NULL || !isatty(STDIN_FILENO);
     return false;  // Indicate that the shell should continue running
 }
\ No newline at end of file
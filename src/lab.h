@@ -1,8 +1,12 @@
 #ifndef LAB_H
 #define LAB_H
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -10,11 +14,43 @@
 #define lab_VERSION_MINOR 0
 #define UNUSED(x) (void)x;
 
+/**
+ * @brief Run a statement and record its latency for a stat point when
+ * stats are enabled. When they are not this costs one branch.
+ */
+#define STATS_MEASURE(point, stmt)                                    \
+  do                                                                  \
+  {                                                                   \
+    if (__builtin_expect(stats_enabled, 0))                           \
+    {                                                                 \
+      uint64_t stats_start_ = phase_clock_ns();                       \
+      stmt;                                                           \
+      stats_record((point), phase_clock_ns() - stats_start_);         \
+    }                                                                 \
+    else                                                              \
+    {                                                                 \
+      stmt;                                                           \
+    }                                                                 \
+  } while (0)
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+  struct arena_chunk;
+
+  /**
+   * @brief Bump allocator for state that lives for a single command. All
+   * allocations are released together by arena_reset.
+   */
+  struct arena
+  {
+    struct arena_chunk *head;    // First chunk
+    struct arena_chunk *current; // Chunk allocations are carved from
+    size_t used;                 // Bytes used in the current chunk
+  };
+
   struct shell
   {
     int shell_is_interactive;
@@ -22,8 +58,212 @@ extern "C"
     struct termios shell_tmodes;
     int shell_terminal;
     char *prompt;
+    struct arena arena; // Per command allocations, reset after each line
+    bool batch;          // Commands come from a script, -c or a pipe
+    const char *command; // Commands given with -c, NULL if none
+    const char *script;  // Script given on the command line, NULL if none
+  };
+
+  /**
+   * @brief Duplicate lines the session history drops
+   */
+  enum hist_dedup
+  {
+    HIST_DEDUP_NONE,        // Keep every line
+    HIST_DEDUP_CONSECUTIVE, // Drop a line equal to the previous one
+    HIST_DEDUP_ALL          // Erase older copies of a line
+  };
+
+  /**
+   * @brief A history entry found by hist_search
+   */
+  struct hist_match
+  {
+    size_t n;  // Number of the entry
+    int score; // 2 if the entry starts with the pattern, 1 if a word does
+  };
+
+  /**
+   * @brief Reads input in large blocks and splits it into lines in place
+   */
+  struct line_reader
+  {
+    int fd;       // Descriptor input is read from
+    char *buf;    // Read buffer
+    size_t size;  // Size of buf
+    size_t start; // Start of the unread input in buf
+    size_t end;   // End of the input in buf
+    bool eof;     // Nothing more to read from fd
+  };
+
+  /**
+   * @brief Byte classes understood by the scan functions
+   */
+  enum scan_class
+  {
+    SCAN_ARG_DELIMS, // Characters that separate arguments in cmd_parse
+    SCAN_SPACE       // Characters isspace accepts in the C locale
   };
 
+  /**
+   * @brief Implementations of the scan functions
+   */
+  enum scan_impl
+  {
+    SCAN_IMPL_AUTO,   // Widest implementation the CPU supports
+    SCAN_IMPL_SCALAR, // One byte at a time with a lookup table
+    SCAN_IMPL_SSE2,   // 16 bytes at a time
+    SCAN_IMPL_AVX2    // 32 bytes at a time
+  };
+
+  /**
+   * @brief Strategy used to start external commands
+   */
+  enum spawn_mode
+  {
+    SPAWN_AUTO, // posix_spawn when the child setup allows it, fork otherwise
+    SPAWN_FORK  // always fork and exec
+  };
+
+  /**
+   * @brief How the job table learns that children exited
+   */
+  enum reap_mode
+  {
+    REAP_AUTO,   // pidfds when the kernel has them, SIGCHLD otherwise
+    REAP_SIGCHLD // always reap from the SIGCHLD handler
+  };
+
+  /**
+   * @brief A file descriptor the child gets before it runs the new program
+   */
+  struct spawn_action
+  {
+    int fd;     // Descriptor in the child
+    int src_fd; // Descriptor of the shell duplicated onto fd
+  };
+
+  /**
+   * @brief Setup applied to a child before it runs the new program
+   */
+  struct spawn_opts
+  {
+    pid_t pgid;   // Process group to join, 0 for a new group, -1 to inherit
+    int terminal; // Terminal to give to the child's group, -1 for none
+    const struct spawn_action *actions; // Applied in order
+    size_t num_actions;                 // Number of entries in actions
+  };
+
+  /**
+   * @brief Kinds of redirection
+   */
+  enum redirect_type
+  {
+    REDIRECT_IN,     // [n]< file
+    REDIRECT_OUT,    // [n]> file
+    REDIRECT_APPEND, // [n]>> file
+    REDIRECT_DUP,    // [n]>& m or [n]<& m
+    REDIRECT_STRING  // [n]<<< word
+  };
+
+  /**
+   * @brief A redirection of one descriptor of a command
+   */
+  struct redirect
+  {
+    enum redirect_type type; // What to do
+    int fd;                  // Descriptor of the command that is redirected
+    const char *target;      // File name, descriptor number or here-string
+  };
+
+  /**
+   * @brief One stage of a pipeline
+   */
+  struct command
+  {
+    char **argv;              // NULL terminated arguments, argv[0] may be NULL
+    struct redirect *redirs;  // Redirections in the order they were given
+    size_t num_redirs;        // Number of redirections
+  };
+
+  /**
+   * @brief Commands connected by pipes that run as a single job
+   */
+  struct pipeline
+  {
+    struct command *commands; // Stages from left to right
+    size_t count;             // Number of stages
+    bool background;          // The line ended with &
+  };
+
+  /**
+   * @brief How the event loop waits
+   */
+  enum loop_backend
+  {
+    LOOP_NONE,  // The loop was not created
+    LOOP_AUTO,  // io_uring if the kernel allows it, epoll otherwise
+    LOOP_URING, // io_uring poll requests
+    LOOP_EPOLL  // epoll
+  };
+
+  /**
+   * @brief Properties of a builtin
+   */
+  enum builtin_flags
+  {
+    BUILTIN_SHELL = 1,  // Changes the shell itself, never a pipeline stage
+    BUILTIN_SPAWNS = 2, // Starts processes that share its standard output
+    BUILTIN_KEYWORD = 4 // Takes the rest of the line, operators included
+  };
+
+  /**
+   * @brief Resources used by a job
+   */
+  struct job_usage
+  {
+    struct timespec started;  // CLOCK_MONOTONIC time the job was added
+    struct timespec finished; // When its last process was reaped, 0 before
+    struct rusage rusage;     // Summed over its reaped processes, ru_maxrss
+                              // is the largest of them
+  };
+
+  /**
+   * @brief Phases of running a command line, see phase.c
+   */
+  enum shell_phase
+  {
+    PHASE_PARSE, // cmd_parse and pipeline_parse
+    PHASE_SPAWN, // spawn_command, until the child runs its program
+    PHASE_RUN,   // From the last spawn until the last process was reaped
+    PHASE_WAIT,  // From the last reap until the shell has the status
+    NUM_PHASES
+  };
+
+  /**
+   * @brief Points of the shell whose latency is recorded, see stats.c
+   */
+  enum stat_point
+  {
+    STAT_LINE,    // A line of the main loop or a script, until the next
+    STAT_PARSE,   // cmd_parse
+    STAT_BUILTIN, // do_builtin
+    STAT_EXECUTE, // execute_command
+    STAT_JOBS,    // update_job_status
+    NUM_STAT_POINTS
+  };
+
+  /**
+   * @brief Descriptor of a command the shell runs itself
+   */
+  struct builtin
+  {
+    const char *name; // Command name
+    int (*run)(struct shell *sh, char **argv, FILE *out); // Returns the status
+    bool (*accepts)(char **argv); // NULL or false for lines left to the
+                                  // external command of the same name
+    unsigned flags;   // enum builtin_flags
+  };
 
 
   /**
@@ -50,7 +290,8 @@ extern "C"
 
   /**
    * @brief Convert line read from the user into to format that will work with
-   * execvp. We limit the number of arguments to ARG_MAX loaded from sysconf.
+   * execvp. The operators | and & are split into their own arguments even
+   * when they are not surrounded by whitespace.
    * This function allocates memory that must be reclaimed with the cmd_free
    * function.
    *
@@ -60,6 +301,30 @@ extern "C"
    */
   char **cmd_parse(char const *line);
 
+  /**
+   * @brief Same as cmd_parse except that the result is allocated from an
+   * arena. It is released by arena_reset and must not be passed to cmd_free.
+   *
+   * @param a The arena to allocate from
+   * @param line The line to process
+   *
+   * @return The line read in a format suitable for exec
+   */
+  char **cmd_parse_arena(struct arena *a, char const *line);
+
+  /**
+   * @brief Same as cmd_parse_arena for a line that is part of a larger
+   * buffer, such as a mapped script. The line is copied into the arena, the
+   * buffer is not modified.
+   *
+   * @param a The arena to allocate from
+   * @param line The start of the line, it does not need a terminator
+   * @param len The length of the line
+   *
+   * @return The line read in a format suitable for exec
+   */
+  char **cmd_parse_view(struct arena *a, char const *line, size_t len);
+
   /**
    * @brief Free the line that was constructed with parse_cmd
    *
@@ -79,6 +344,125 @@ extern "C"
   char *trim_white(char *line);
 
 
+  /**
+   * @brief Count the tokens in text that are separated by runs of bytes of
+   * a class. Only the bytes in [text, text + len) are read.
+   *
+   * @param cls The delimiter class
+   * @param text The text
+   * @param len The length of the text
+   * @return The number of tokens
+   */
+  size_t scan_count_tokens(enum scan_class cls, const char *text, size_t len);
+
+  /**
+   * @brief Split text into tokens separated by runs of bytes of a class.
+   * The first delimiter after each token is overwritten with '\0'.
+   *
+   * @param cls The delimiter class
+   * @param buf The text, buf[len] must be '\0'
+   * @param len The length of the text
+   * @param tokens Receives a pointer to each token, it must have room for
+   * scan_count_tokens(cls, buf, len) entries
+   * @return The number of tokens
+   */
+  size_t scan_split(enum scan_class cls, char *buf, size_t len, char **tokens);
+
+  /**
+   * @brief Skip over bytes of a class. Only the bytes in [p, end) are read.
+   *
+   * @param cls The byte class
+   * @param p Start of the text
+   * @param end End of the text
+   * @return The first byte at or after p that is not in the class, or end
+   */
+  const char *scan_skip(enum scan_class cls, const char *p, const char *end);
+
+  /**
+   * @brief Find the next byte of a class. Only the bytes in [p, end) are
+   * read.
+   *
+   * @param cls The byte class
+   * @param p Start of the text
+   * @param end End of the text
+   * @return The first byte at or after p that is in the class, or end
+   */
+  const char *scan_find(enum scan_class cls, const char *p, const char *end);
+
+  /**
+   * @brief Skip backwards over bytes of a class that end the text. Only the
+   * bytes in [start, end) are read.
+   *
+   * @param cls The byte class
+   * @param start Start of the text
+   * @param end End of the text
+   * @return One past the last byte that is not in the class, or start
+   */
+  const char *scan_rskip(enum scan_class cls, const char *start, const char *end);
+
+  /**
+   * @brief Select the implementation used by the scan functions. The widest
+   * implementation the CPU supports is selected at startup, so this is only
+   * needed to compare implementations.
+   *
+   * @param impl The implementation
+   * @return On success, zero is returned. If the CPU does not support the
+   * implementation, -1 is returned, and errno is set to ENOTSUP.
+   */
+  int scan_set_impl(enum scan_impl impl);
+
+  /**
+   * @brief Initialize an empty arena. A zero initialized arena is also
+   * valid.
+   *
+   * @param a The arena
+   */
+  void arena_init(struct arena *a);
+
+  /**
+   * @brief Allocate memory from an arena. The memory is aligned for any
+   * type and stays valid until the next arena_reset or arena_destroy. If the
+   * system is out of memory the shell exits.
+   *
+   * @param a The arena
+   * @param size The number of bytes
+   * @return The allocated memory
+   */
+  void *arena_alloc(struct arena *a, size_t size);
+
+  /**
+   * @brief Copy a string into an arena
+   *
+   * @param a The arena
+   * @param s The string to copy
+   * @return The copy
+   */
+  char *arena_strdup(struct arena *a, const char *s);
+
+  /**
+   * @brief Release every allocation made from an arena. A few default
+   * sized chunks are kept by the arena and handed out again by later
+   * allocations, larger or further chunks are freed.
+   *
+   * @param a The arena
+   */
+  void arena_reset(struct arena *a);
+
+  /**
+   * @brief Get the number of bytes an arena holds, in use or not
+   *
+   * @param a The arena
+   * @return The usable size of all of its chunks
+   */
+  size_t arena_reserved(const struct arena *a);
+
+  /**
+   * @brief Return all of the memory held by an arena to the system
+   *
+   * @param a The arena
+   */
+  void arena_destroy(struct arena *a);
+
   /**
    * @brief Takes an argument list and checks if the first argument is a
    * built in command such as exit, cd, jobs, etc. If the command is a
@@ -92,6 +476,172 @@ extern "C"
    */
   bool do_builtin(struct shell *sh, char **argv);
 
+  /**
+   * @brief Check whether a command is a built in command
+   *
+   * @param argv The command to check
+   * @return True if builtin_run would handle the command
+   */
+  bool is_builtin(char **argv);
+
+  /**
+   * @brief Find the builtin with a name. The descriptors are kept in a
+   * perfect hash table, so a lookup costs one hash and one string compare
+   * however many builtins there are.
+   *
+   * @param name The command name
+   * @return The descriptor or NULL if there is no builtin with that name
+   */
+  const struct builtin *builtin_lookup(const char *name);
+
+  /**
+   * @brief Get every builtin of the shell
+   *
+   * @param count Receives the number of builtins
+   * @return The descriptors, in no particular order
+   */
+  const struct builtin *builtin_table(size_t *count);
+
+  /**
+   * @brief The ls builtin. Supports -a, -l and -U and any number of file
+   * and directory operands, names are sorted bytewise.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @param out The stream the listing is written to
+   * @return 0 on success, 1 if an operand could not be listed
+   */
+  int builtin_ls(struct shell *sh, char **argv, FILE *out);
+
+  /**
+   * @brief Check whether builtin_ls implements every option of a command,
+   * other ls commands are run by the external ls
+   *
+   * @param argv The command
+   * @return True if builtin_ls can run the command
+   */
+  bool builtin_ls_accepts(char **argv);
+
+  /**
+   * @brief The parallel builtin. Runs a command for every input after :::
+   * or every line of standard input with at most -j of them at a time.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @param out Unused, the jobs write to standard output
+   * @return The number of jobs that failed, at most 101, or 255 on a usage
+   * error
+   */
+  int builtin_parallel(struct shell *sh, char **argv, FILE *out);
+
+  /**
+   * @brief Run a built in command and send its output to a stream. Unlike
+   * do_builtin this does not check for pipeline operators.
+   *
+   * @param sh The shell
+   * @param argv The command to run
+   * @param out The stream the command writes its output to
+   * @param status Receives the exit status of the command, may be NULL
+   * @return True if the command was a built in command
+   */
+  bool builtin_run(struct shell *sh, char **argv, FILE *out, int *status);
+
+  /**
+   * @brief Create the event loop of the interactive shell, which waits for
+   * input on several descriptors and for timers at once
+   *
+   * @param want The backend, LOOP_AUTO picks io_uring with epoll as the
+   * fallback
+   * @return 0 on success, -1 on error with errno set
+   */
+  int loop_init(enum loop_backend want);
+
+  /**
+   * @brief Free the event loop, dropping every watch and timer
+   */
+  void loop_destroy(void);
+
+  /**
+   * @brief The backend the event loop runs on
+   *
+   * @return LOOP_URING, LOOP_EPOLL or LOOP_NONE if there is no loop
+   */
+  enum loop_backend loop_backend(void);
+
+  /**
+   * @brief Call a function from loop_run_once whenever a descriptor has
+   * input, for as long as the input is not read
+   *
+   * @param fd The descriptor
+   * @param fn Called with fd and arg
+   * @param arg Passed to fn
+   * @return 0 on success, -1 on error with errno set
+   */
+  int loop_watch(int fd, void (*fn)(int fd, void *arg), void *arg);
+
+  /**
+   * @brief Stop watching a descriptor, before it is closed
+   *
+   * @param fd The descriptor
+   */
+  void loop_unwatch(int fd);
+
+  /**
+   * @brief Call a function from loop_run_once once a delay has passed
+   *
+   * @param ms Delay in milliseconds
+   * @param fn Called with arg
+   * @param arg Passed to fn
+   * @return Id of the timer, -1 on error with errno set
+   */
+  int loop_timer_add(unsigned ms, void (*fn)(void *arg), void *arg);
+
+  /**
+   * @brief Cancel a timer that has not fired
+   *
+   * @param id Id returned by loop_timer_add
+   */
+  void loop_timer_cancel(int id);
+
+  /**
+   * @brief Wait until a watched descriptor has input or a timer is due
+   * and call their functions
+   *
+   * @return Number of functions called, 0 if a signal interrupted the
+   * wait, -1 on error with errno set
+   */
+  int loop_run_once(void);
+
+  /**
+   * @brief Descriptor that becomes readable when a child exits, for the
+   * event loop to watch. With pidfds it is the epoll set of the pidfds of
+   * live children, otherwise the pipe the SIGCHLD handler writes to. It
+   * is cleared by update_job_status.
+   *
+   * @return The epoll set or the read end of the notification pipe, -1 if
+   * there is none
+   */
+  int jobs_notify_fd(void);
+
+  /**
+   * @brief Check whether children were reaped that update_job_status has
+   * not looked at yet
+   *
+   * @return True if update_job_status may have jobs to report
+   */
+  bool jobs_reaped_pending(void);
+
+  /**
+   * @brief Open a stream that writes into a pipe. Full buffers are handed
+   * to the kernel with vmsplice so the data is not copied a second time,
+   * with write as the fallback for descriptors that are not pipes. Closing
+   * the stream closes fd.
+   *
+   * @param fd The write end of a pipe, owned by the stream from now on
+   * @return The stream, or NULL with errno set on error
+   */
+  FILE *pipe_sink_open(int fd);
+
   /**
    * @brief Initialize the shell for use. Allocate all data structures
    * Grab control of the terminal and put the shell in its own
@@ -112,39 +662,290 @@ extern "C"
    */
   void sh_destroy(struct shell *sh);
 
+  /**
+   * @brief Run one line of input: trim it, parse it and run it as a builtin
+   * or with execute_command. The per command arena is reset afterwards.
+   *
+   * @param sh The shell
+   * @param line The line
+   * @return The exit status of the command, 0 for empty lines
+   */
+  int sh_eval(struct shell *sh, char *line);
+
+  /**
+   * @brief Run one line of input that is part of a larger buffer. The
+   * buffer is not modified, so it may be a read only mapping.
+   *
+   * @param sh The shell
+   * @param line The start of the line, it does not need a terminator
+   * @param len The length of the line
+   * @return The exit status of the command, 0 for empty lines
+   */
+  int sh_eval_view(struct shell *sh, const char *line, size_t len);
+
+  /**
+   * @brief Run the commands in a script without readline
+   *
+   * @param sh The shell
+   * @param path Path of the script, NULL for standard input
+   * @return The exit status of the last command, 127 if the script could
+   * not be opened
+   */
+  int sh_run_script(struct shell *sh, const char *path);
+
+  /**
+   * @brief Run commands given as a string, one command per line
+   *
+   * @param sh The shell
+   * @param commands The commands
+   * @return The exit status of the last command
+   */
+  int sh_run_string(struct shell *sh, const char *commands);
+
+  /**
+   * @brief Open the persistent history. Nothing is read until an entry is
+   * looked up.
+   *
+   * @param path Path of the history log, NULL for $HISTFILE or
+   * ~/.lab_history. The index is kept next to it with ".idx" appended.
+   * @return 0 on success, -1 on error with errno set
+   */
+  int hist_open(const char *path);
+
+  /**
+   * @brief Close the persistent history
+   */
+  void hist_close(void);
+
+  /**
+   * @brief Append a command to the persistent history. Safe to call from
+   * several sessions at once.
+   *
+   * @param line The command, it must not contain a newline
+   * @param n Receives the number of the new entry, may be NULL
+   * @return 0 on success, -1 on error with errno set
+   */
+  int hist_add(const char *line, size_t *n);
+
+  /**
+   * @brief Number of entries in the persistent history, including the ones
+   * added by other sessions
+   *
+   * @return The number of entries, 0 if the history is not open
+   */
+  size_t hist_count(void);
+
+  /**
+   * @brief Look up an entry of the persistent history in constant time
+   *
+   * @param n The number of the entry, the first entry is 1
+   * @param len Receives the length of the entry
+   * @return The entry, not terminated and only valid until the next call to
+   * a hist_ function, or NULL if there is no entry n
+   */
+  const char *hist_get(size_t n, size_t *len);
+
+  /**
+   * @brief Search the persistent history for entries containing a pattern.
+   * The trigram index behind the search is built on first use and then
+   * only indexes the entries added since the previous search. Repeated
+   * commands are reported once.
+   *
+   * @param pattern The text to look for
+   * @param matches Receives the best matches, best first: entries that
+   * start with the pattern, then entries where a word does, then the rest,
+   * newest first within each group
+   * @param max The size of matches
+   * @return The number of matches stored
+   */
+  size_t hist_search(const char *pattern, struct hist_match *matches, size_t max);
+
+  /**
+   * @brief Drop the trigram index of the history search
+   */
+  void hist_search_reset(void);
+
+  /**
+   * @brief Create the session history, a ring that keeps the last capacity
+   * lines so its memory use stays constant
+   *
+   * @param capacity The number of lines kept
+   * @param dedup Which duplicate lines are eliminated
+   * @return 0 on success, -1 on error with errno set
+   */
+  int hist_ring_init(size_t capacity, enum hist_dedup dedup);
+
+  /**
+   * @brief Create the session history with the capacity in HISTSIZE
+   * (1000 if unset) and duplicate elimination from HISTCONTROL
+   * (ignoredups, ignoreboth or erasedups)
+   *
+   * @return 0 on success, -1 on error with errno set
+   */
+  int hist_ring_init_env(void);
+
+  /**
+   * @brief The number of lines the session history keeps
+   *
+   * @return The capacity, 0 if the session history was not created
+   */
+  size_t hist_ring_capacity(void);
+
+  /**
+   * @brief Free the session history
+   */
+  void hist_ring_destroy(void);
+
+  /**
+   * @brief Add a line to the session history. When the history is full the
+   * oldest line is dropped.
+   *
+   * @param line The line
+   * @param seq The number of the entry as used by !n, 0 to number it after
+   * the newest entry
+   * @return 1 if the line was added, 0 if it was dropped as a duplicate, -1
+   * on error with errno set
+   */
+  int hist_ring_add(const char *line, uint64_t seq);
+
+  /**
+   * @brief Visit the entries of the session history, oldest first
+   *
+   * @param fn Called with the number and text of each entry
+   * @param arg Passed to fn
+   */
+  void hist_ring_foreach(void (*fn)(uint64_t seq, const char *line, void *arg), void *arg);
+
+  /**
+   * @brief Expand a line of the form !n to history entry n
+   *
+   * @param line The line typed by the user
+   * @return A newly allocated copy of the expanded line, or of the line
+   * itself if it is not a history reference. If there is no such entry an
+   * error is printed and NULL is returned.
+   */
+  char *hist_expand(const char *line);
+
+  /**
+   * @brief Initialize a line reader
+   *
+   * @param r The reader
+   * @param fd The descriptor to read from, it is not closed by the reader
+   * @return 0 on success, -1 if memory could not be allocated
+   */
+  int line_reader_init(struct line_reader *r, int fd);
+
+  /**
+   * @brief Return the next line of input. A last line without a newline is
+   * returned as well.
+   *
+   * @param r The reader
+   * @return The line without its newline, valid until the next call, or
+   * NULL at the end of the input
+   */
+  char *line_reader_next(struct line_reader *r);
+
+  /**
+   * @brief Release the memory of a line reader
+   *
+   * @param r The reader
+   */
+  void line_reader_destroy(struct line_reader *r);
+
 /**
  * @brief Parse command-line arguments for the shell
  *
  * This function processes command-line arguments passed to the shell.
- * It specifically handles the -v option to print the shell version.
+ * It handles the -v option to print the shell version, -c to run a string
+ * of commands and a script to run. Without either, the shell runs in batch
+ * mode when standard input is not a terminal.
  *
  * @param argc The number of command-line arguments
  * @param argv An array of strings containing the command-line arguments
+ * @param sh The shell, the batch, command and script fields are set
  * @return bool Returns true if the shell should exit after parsing (e.g., if -v was used),
  *              false if the shell should continue normal operation
  */
-  bool parse_args(int argc, char **argv);
+  bool parse_args(int argc, char **argv, struct shell *sh);
 
   /**
-   * @brief Print the command history of the shell
+   * @brief Print the command history of the shell, from the session
+   * history when it was created
+   *
+   * @param out The stream to print to
    */
-  void print_history();
+  void print_history(FILE *out);
 
   /**
-   * @brief Initialize the job control system for the shell
+   * @brief Initialize the job control system for the shell. This empties
+   * the job table and sets up child tracking. When the kernel has pidfds,
+   * SIGCHLD is set to SIG_DFL and children are tracked through an epoll
+   * set of pidfds. Otherwise the SIGCHLD handler that reaps jobs is
+   * installed.
    */
   void initialize_jobs();
 
+  /**
+   * @brief Select how children are reaped, from the next initialize_jobs
+   * on. The default is REAP_AUTO, REAP_SIGCHLD is mostly useful to test
+   * the handler on kernels with pidfds.
+   *
+   * @param mode The reaping strategy
+   */
+  void set_reap_mode(enum reap_mode mode);
+
+  /**
+   * @brief Free all memory held by the job table
+   */
+  void destroy_jobs();
+
   /**
    * @brief Add a new job to the job list
    *
    * @param pid The process ID of the job
    * @param command The command string of the job
    * @param is_background Whether the job is running in the background
-   * @return The job ID of the newly added job
+   * @return The job ID of the newly added job, or -1 if out of memory.
+   * The job table grows as needed.
    */
   int add_job(pid_t pid, char *command, bool is_background);
 
+  /**
+   * @brief Add a pipeline to the job list as a single job
+   *
+   * @param pids The processes of the pipeline, pids[0] leads its process
+   * group
+   * @param count The number of processes
+   * @param command The command string of the job
+   * @param is_background Whether the job is running in the background
+   * @return The job ID of the newly added job, or -1 if out of memory
+   */
+  int add_pipeline_job(const pid_t *pids, int count, char *command, bool is_background);
+
+  /**
+   * @brief Wait for every process of a foreground job to exit. A finished
+   * job is removed from the job list. If the job is stopped it is kept as
+   * a stopped background job.
+   *
+   * @param job_id The ID of the job
+   * @return The exit status of the last process of the pipeline, 128 plus
+   * the signal number if it was killed or stopped, or -1 if there is no
+   * such job
+   */
+  int wait_for_job(int job_id);
+
+  /**
+   * @brief Wait until one of several background jobs finishes, sleeping
+   * until a child exits. A job that finished is removed from the job list.
+   *
+   * @param job_ids The IDs of the jobs, entries that are 0 are skipped
+   * @param count The number of entries
+   * @param status Receives the exit status of the job that finished
+   * @return The index of the finished job in job_ids, or -1 if none of the
+   * jobs exist
+   */
+  int wait_for_any_job(const int *job_ids, int count, int *status);
+
   /**
    * @brief Remove a job from the job list
    *
@@ -153,24 +954,290 @@ extern "C"
   void remove_job(int job_id);
 
   /**
-   * @brief Update the status of all jobs in the job list
+   * @brief Report the jobs that finished since the last call. With pidfds
+   * this function reaps the children whose pidfds became readable with
+   * waitid(P_PIDFD), without them it takes the children the shell's
+   * SIGCHLD handler reaped as soon as they exited. Either way only the
+   * jobs that finished are visited.
    */
   void update_job_status();
 
   /**
-   * @brief Print the list of current jobs
+   * @brief Remove the finished jobs from the job table without reporting
+   * them, used when no user is watching
+   */
+  void prune_jobs(void);
+
+  /**
+   * @brief Print the list of current jobs. Finished jobs are listed once
+   * and then removed from the job table.
+   *
+   * @param out The stream to print to
+   */
+  void print_jobs(FILE *out);
+
+  /**
+   * @brief Same as print_jobs, every job is followed by a line with the
+   * wall clock and CPU time, peak resident set size, page faults and
+   * context switches of the processes that exited so far
+   *
+   * @param out The stream to print to
+   */
+  void print_jobs_long(FILE *out);
+
+  /**
+   * @brief Get the resources used by the last foreground job that finished
+   *
+   * @param usage Receives the usage, all zero if no job finished yet or the
+   * last job waited for was stopped
+   */
+  void job_last_usage(struct job_usage *usage);
+
+  /**
+   * @brief Start summing the usage of the jobs of a new command line.
+   * Called by phase_reset.
+   */
+  void jobs_line_reset(void);
+
+  /**
+   * @brief Get the resources used by the processes reaped so far of the
+   * jobs started since the last jobs_line_reset, foreground and background
+   *
+   * @param ru Receives the usage
+   */
+  void jobs_line_usage(struct rusage *ru);
+
+  /**
+   * @brief Split an argument vector into pipeline stages at "|" tokens. A
+   * trailing "&" makes the pipeline run in the background. The operator
+   * tokens in argv are replaced with NULL so each stage's argv points into
+   * the original vector. Redirections and their targets are moved out of
+   * each stage's argv into its list of redirections.
+   *
+   * @param a The arena to allocate the pipeline from
+   * @param argv The argument vector from cmd_parse
+   * @return The pipeline. On a syntax error an error message is printed and
+   * NULL is returned.
+   */
+  struct pipeline *pipeline_parse(struct arena *a, char **argv);
+
+  /**
+   * @brief Parse a redirection operator such as <, 2>>, >& or <<<
+   *
+   * @param token The token to parse
+   * @param r Receives the type and descriptor, target is set to NULL
+   * @return True if the token is a redirection operator
+   */
+  bool redirect_parse(const char *token, struct redirect *r);
+
+  /**
+   * @brief Open the files named by a list of redirections. Every descriptor
+   * is close-on-exec and above the range commands use, so it only reaches a
+   * child through the returned spawn actions. On error a message is printed
+   * and nothing is left open.
+   *
+   * @param redirs The redirections
+   * @param num_redirs The number of redirections
+   * @param actions Receives one spawn action per redirection
+   * @return 0 on success, -1 on error
+   */
+  int redirect_open(const struct redirect *redirs, size_t num_redirs,
+                    struct spawn_action *actions);
+
+  /**
+   * @brief Close the descriptors opened by redirect_open
+   *
+   * @param redirs The redirections
+   * @param num_redirs The number of redirections
+   * @param actions The spawn actions filled in by redirect_open
    */
-  void print_jobs();
+  void redirect_close(const struct redirect *redirs, size_t num_redirs,
+                      const struct spawn_action *actions);
 
   /**
-   * @brief Execute a command in the shell
+   * @brief Apply spawn actions to the descriptors of the shell itself, used
+   * to run a builtin with redirections. On error a message is printed and
+   * nothing is left applied.
+   *
+   * @param actions The actions, applied in order
+   * @param num_actions The number of actions
+   * @param saved Receives one saved descriptor per action
+   * @return 0 on success, -1 on error
+   */
+  int redirect_apply(const struct spawn_action *actions, size_t num_actions, int *saved);
+
+  /**
+   * @brief Undo redirect_apply
+   *
+   * @param actions The actions that were applied
+   * @param num_actions The number of actions
+   * @param saved The descriptors saved by redirect_apply
+   */
+  void redirect_restore(const struct spawn_action *actions, size_t num_actions,
+                        const int *saved);
+
+  /**
+   * @brief Check whether a token is an operator such as |, & or >>
+   *
+   * @param token The token
+   * @return True if the whole token is one operator
+   */
+  bool is_operator(const char *token);
+
+  /**
+   * @brief Execute a command in the shell. The command may be a pipeline
+   * and may end with & to run it in the background. The whole pipeline is
+   * one job in one process group.
    *
    * @param argv The argument vector containing the command and its arguments
    * @param sh The shell structure
-   * @return The exit status of the executed command
+   * @return The exit status of the last stage of the pipeline, 0 for
+   * background jobs
    */
   int execute_command(char **argv, struct shell *sh);
 
+  /**
+   * @brief Start a command as a background job without announcing it. The
+   * command may be a pipeline.
+   *
+   * @param argv The argument vector, the operators are replaced with NULL
+   * @param sh The shell structure
+   * @param status Receives the status of the command when no job was
+   * started, such as 127 when it was not found
+   * @return The ID of the job, 0 if no process was started
+   */
+  int start_job(char **argv, struct shell *sh, int *status);
+
+  /**
+   * @brief Start an external command without waiting for it. The child's
+   * job control signals are reset to their default dispositions and its
+   * signal mask is cleared. posix_spawn is used whenever the setup in opts
+   * can be expressed with spawn attributes, otherwise the shell forks.
+   *
+   * @param argv The argument vector, argv[0] is looked up in PATH through
+   * the path hash table unless it contains a slash
+   * @param opts The child setup
+   * @return The pid of the child. On error, -1 is returned, and errno is
+   * set to indicate the error.
+   */
+  pid_t spawn_command(char **argv, const struct spawn_opts *opts);
+
+  /**
+   * @brief Select how spawn_command starts processes. The default is
+   * SPAWN_AUTO, SPAWN_FORK is mostly useful for benchmarking.
+   *
+   * @param mode The spawn strategy
+   */
+  void set_spawn_mode(enum spawn_mode mode);
+
+  /**
+   * @brief Look up the absolute path of a command, searching PATH only if
+   * the command is not already in the hash table. The table is flushed when
+   * PATH changes. The returned string is owned by the table and stays valid
+   * until the entry is forgotten.
+   *
+   * @param name The command name, must not contain a slash
+   * @return The absolute path of the command. If the command is not found,
+   * NULL is returned and errno is set to ENOENT.
+   */
+  const char *path_hash_lookup(const char *name);
+
+  /**
+   * @brief Remove a single command from the hash table
+   *
+   * @param name The command name
+   */
+  void path_hash_forget(const char *name);
+
+  /**
+   * @brief Remove every command from the hash table and free its memory
+   */
+  void path_hash_clear(void);
+
+  /**
+   * @brief Print the commands in the hash table with their hit counts
+   *
+   * @param out The stream to print to
+   */
+  void path_hash_print(FILE *out);
+
+  /**
+   * @brief Read the monotonic clock
+   *
+   * @return Nanoseconds since an arbitrary point
+   */
+  uint64_t phase_clock_ns(void);
+
+  /**
+   * @brief Set the time spent in every phase to zero, done by sh_eval_view
+   * before each line
+   */
+  void phase_reset(void);
+
+  /**
+   * @brief Add time to a phase
+   *
+   * @param phase The phase
+   * @param ns Nanoseconds spent in it
+   */
+  void phase_add(enum shell_phase phase, uint64_t ns);
+
+  /**
+   * @brief Get the time spent in a phase since the last reset
+   *
+   * @param phase The phase
+   * @return Nanoseconds spent in it
+   */
+  uint64_t phase_total_ns(enum shell_phase phase);
+
+  /**
+   * @brief Whether STATS_MEASURE records anything, false by default
+   */
+  extern bool stats_enabled;
+
+  /**
+   * @brief Record one call of a stat point in the histograms of the
+   * calling thread
+   *
+   * @param point The point
+   * @param ns How long the call took
+   */
+  void stats_record(enum stat_point point, uint64_t ns);
+
+  /**
+   * @brief Forget everything the calling thread recorded
+   */
+  void stats_reset(void);
+
+  /**
+   * @brief Get the number of calls the calling thread recorded for a point
+   *
+   * @param point The point
+   * @return The count
+   */
+  uint64_t stats_count(enum stat_point point);
+
+  /**
+   * @brief Get the latency below which a fraction of the calls of a point
+   * fell, accurate to the 1/16 of it that its bucket covers
+   *
+   * @param point The point
+   * @param q The fraction, between 0 and 1
+   * @return The latency in nanoseconds, 0 without calls
+   */
+  uint64_t stats_quantile(enum stat_point point, double q);
+
+  /**
+   * @brief The shstats builtin. Prints the stats as a table, or as JSON
+   * with -j, and turns recording on and off or resets it.
+   *
+   * @param sh The shell
+   * @param argv The command
+   * @param out The stream the stats are written to
+   * @return 0 on success, 1 on a usage error
+   */
+  int builtin_shstats(struct shell *sh, char **argv, FILE *out);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
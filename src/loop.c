@@ -0,0 +1,493 @@
+/**
+ * @file loop.c
+ * @author Waylon Walsh
+ * @brief Event loop of the interactive shell
+ * @date 2026-10-16
+ *
+ * The interactive shell waits on several things at once: keys typed at
+ * the terminal, children that exit in the background and timers such as
+ * TMOUT. The loop watches descriptors for input and calls a function for
+ * each one that is ready, timers are a timerfd armed for the nearest
+ * deadline, so everything the loop waits for is a descriptor.
+ *
+ * The loop runs on io_uring when the kernel allows it, with one poll
+ * request per watched descriptor that is submitted again after its
+ * function ran. It is driven with the raw system calls, the rings are
+ * mapped here rather than through liburing. Where io_uring is missing or
+ * disabled the loop uses epoll instead, both behave the same to callers:
+ * a descriptor is reported for as long as it has input.
+ *
+ * The loop holds a handful of descriptors and timers, so both live in
+ * small arrays that are searched linearly.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <linux/io_uring.h>
+#include "lab.h"
+
+#define LOOP_MAX_WATCHES 16  // Descriptors watched at once
+#define LOOP_MAX_TIMERS 16   // Timers pending at once
+#define LOOP_RING_ENTRIES 64 // Submission queue size, above twice the watches
+
+/**
+ * @brief A watched descriptor
+ */
+struct loop_watch {
+    int fd;                           // The descriptor, -1 for a free entry
+    void (*fn)(int fd, void *arg);    // Called when fd has input
+    void *arg;                        // Passed to fn
+    uint64_t serial;                  // Tells events of this watch from older ones
+    bool armed;                       // A poll request is pending, io_uring only
+};
+
+/**
+ * @brief A pending timer
+ */
+struct loop_timer {
+    int id;                  // Timer id, 0 for a free entry
+    uint64_t deadline;       // CLOCK_MONOTONIC time in nanoseconds
+    void (*fn)(void *arg);   // Called when the deadline passed
+    void *arg;               // Passed to fn
+};
+
+/**
+ * @brief The rings shared with the kernel
+ */
+struct loop_ring {
+    void *sq_map, *cq_map;          // Ring mappings, equal with a single mapping
+    size_t sq_map_size, cq_map_size;
+    struct io_uring_sqe *sqes;      // Submission entries
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;      // Completion entries
+    unsigned to_submit;             // Entries queued since the last enter
+};
+
+static enum loop_backend backend = LOOP_NONE;
+static int loop_fd = -1;        // io_uring or epoll descriptor
+static struct loop_ring ring;
+static struct loop_watch watches[LOOP_MAX_WATCHES];
+static uint64_t next_serial = 1;
+static struct loop_timer timers[LOOP_MAX_TIMERS];
+static int next_timer_id = 1;
+static int timer_fd = -1;
+
+/**
+ * @brief Current CLOCK_MONOTONIC time
+ *
+ * @return uint64_t Nanoseconds
+ */
+static uint64_t loop_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Set up an io_uring instance and map its rings
+ *
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int ring_setup(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, LOOP_RING_ENTRIES, &p);
+    if (fd < 0) return -1;
+
+    ring.sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring.cq_map_size > ring.sq_map_size) ring.sq_map_size = ring.cq_map_size;
+
+    ring.sq_map = mmap(NULL, ring.sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+    if (ring.sq_map == MAP_FAILED) goto fail;
+    if (single) {
+        ring.cq_map = ring.sq_map;
+    } else {
+        ring.cq_map = mmap(NULL, ring.cq_map_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring.cq_map == MAP_FAILED) goto fail;
+    }
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                     IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) goto fail;
+
+    char *sq = ring.sq_map, *cq = ring.cq_map;
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring.to_submit = 0;
+    loop_fd = fd;
+    return 0;
+
+fail:;
+    int err = errno;
+    if (ring.sq_map && ring.sq_map != MAP_FAILED) munmap(ring.sq_map, ring.sq_map_size);
+    if (!single && ring.cq_map && ring.cq_map != MAP_FAILED) munmap(ring.cq_map, ring.cq_map_size);
+    memset(&ring, 0, sizeof(ring));
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+/**
+ * @brief Unmap the rings
+ */
+static void ring_teardown(void) {
+    if (ring.sqes) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_map && ring.cq_map != ring.sq_map) munmap(ring.cq_map, ring.cq_map_size);
+    if (ring.sq_map) munmap(ring.sq_map, ring.sq_map_size);
+    memset(&ring, 0, sizeof(ring));
+}
+
+/**
+ * @brief Hand the queued submissions to the kernel, optionally waiting
+ *
+ * @param wait Wait for at least one completion
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int ring_enter(bool wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int rval = (int)syscall(__NR_io_uring_enter, loop_fd, ring.to_submit, wait ? 1 : 0, flags,
+                            NULL, 0);
+    if (rval < 0) return -1;
+    ring.to_submit -= (unsigned)rval < ring.to_submit ? (unsigned)rval : ring.to_submit;
+    return 0;
+}
+
+/**
+ * @brief Get a free submission entry
+ *
+ * @return struct io_uring_sqe* The entry, cleared, NULL if the queue is full
+ */
+static struct io_uring_sqe *ring_get_sqe(void) {
+    unsigned tail = *ring.sq_tail;
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)ring.sq_head, memory_order_acquire);
+    if (tail - head == *ring.sq_entries) {
+        if (ring_enter(false) < 0) return NULL;
+        head = atomic_load_explicit((_Atomic unsigned *)ring.sq_head, memory_order_acquire);
+        if (tail - head == *ring.sq_entries) return NULL;
+    }
+
+    unsigned i = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[i] = i;
+    atomic_store_explicit((_Atomic unsigned *)ring.sq_tail, tail + 1, memory_order_release);
+    ring.to_submit++;
+    return sqe;
+}
+
+/**
+ * @brief Queue a one shot poll for input on a watched descriptor
+ *
+ * @param w The watch
+ * @return int 0 on success, -1 if the queue is full
+ */
+static int ring_arm(struct loop_watch *w) {
+    struct io_uring_sqe *sqe = ring_get_sqe();
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = w->fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = w->serial;
+    w->armed = true;
+    return 0;
+}
+
+/**
+ * @brief Find the watch of a descriptor
+ *
+ * @param fd The descriptor
+ * @return struct loop_watch* The watch or NULL
+ */
+static struct loop_watch *watch_find(int fd) {
+    for (size_t i = 0; i < LOOP_MAX_WATCHES; i++) {
+        if (watches[i].fd == fd) return &watches[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Arm the timerfd for the nearest deadline, or disarm it
+ */
+static void timer_rearm(void) {
+    uint64_t nearest = 0;
+    for (size_t i = 0; i < LOOP_MAX_TIMERS; i++) {
+        if (timers[i].id != 0 && (nearest == 0 || timers[i].deadline < nearest)) {
+            nearest = timers[i].deadline;
+        }
+    }
+    // A zero it_value disarms, a deadline in the past fires at once
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    if (nearest != 0) {
+        its.it_value.tv_sec = (time_t)(nearest / 1000000000ULL);
+        its.it_value.tv_nsec = (long)(nearest % 1000000000ULL);
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * @brief Run the timers whose deadline passed
+ *
+ * @param fd The timerfd
+ * @param arg Unused
+ */
+static void timer_ready(int fd, void *arg) {
+    UNUSED(arg)
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) return;
+
+    uint64_t now = loop_now();
+    for (size_t i = 0; i < LOOP_MAX_TIMERS; i++) {
+        if (timers[i].id != 0 && timers[i].deadline <= now) {
+            // Free the entry first, the function may add a timer
+            struct loop_timer t = timers[i];
+            timers[i].id = 0;
+            t.fn(t.arg);
+        }
+    }
+    timer_rearm();
+}
+
+/**
+ * @brief Create the event loop
+ *
+ * @param want Backend to use, LOOP_AUTO for io_uring with epoll as fallback
+ * @return int 0 on success, -1 on error with errno set
+ */
+int loop_init(enum loop_backend want) {
+    loop_destroy();
+    for (size_t i = 0; i < LOOP_MAX_WATCHES; i++) watches[i].fd = -1;
+
+    if (want == LOOP_AUTO || want == LOOP_URING) {
+        if (ring_setup() == 0) {
+            backend = LOOP_URING;
+        } else if (want == LOOP_URING) {
+            return -1;
+        }
+    }
+    if (backend == LOOP_NONE) {
+        loop_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop_fd < 0) return -1;
+        backend = LOOP_EPOLL;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0 || loop_watch(timer_fd, timer_ready, NULL) < 0) {
+        int err = errno;
+        loop_destroy();
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Free the event loop, watches and timers are dropped
+ */
+void loop_destroy(void) {
+    if (backend == LOOP_URING) ring_teardown();
+    if (loop_fd >= 0) close(loop_fd);
+    if (timer_fd >= 0) close(timer_fd);
+    loop_fd = -1;
+    timer_fd = -1;
+    backend = LOOP_NONE;
+    for (size_t i = 0; i < LOOP_MAX_WATCHES; i++) watches[i].fd = -1;
+    memset(timers, 0, sizeof(timers));
+}
+
+/**
+ * @brief The backend the loop runs on
+ *
+ * @return enum loop_backend LOOP_URING, LOOP_EPOLL or LOOP_NONE
+ */
+enum loop_backend loop_backend(void) {
+    return backend;
+}
+
+/**
+ * @brief Call a function whenever a descriptor has input
+ *
+ * @param fd The descriptor
+ * @param fn Called with fd and arg
+ * @param arg Passed to fn
+ * @return int 0 on success, -1 on error with errno set
+ */
+int loop_watch(int fd, void (*fn)(int fd, void *arg), void *arg) {
+    if (backend == LOOP_NONE || fd < 0 || watch_find(fd) != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct loop_watch *w = watch_find(-1);
+    if (w == NULL) {
+        errno = ENOSPC;
+        return -1;
+    }
+    *w = (struct loop_watch){ fd, fn, arg, next_serial++, false };
+
+    int rval;
+    if (backend == LOOP_URING) {
+        rval = ring_arm(w);
+        if (rval < 0) errno = EBUSY;
+    } else {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = w->serial };
+        rval = epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if (rval < 0) w->fd = -1;
+    return rval;
+}
+
+/**
+ * @brief Stop watching a descriptor
+ *
+ * @param fd The descriptor
+ */
+void loop_unwatch(int fd) {
+    struct loop_watch *w = fd >= 0 ? watch_find(fd) : NULL;
+    if (w == NULL) return;
+
+    if (backend == LOOP_URING) {
+        // The cancelled poll completes later and is ignored by its serial
+        if (w->armed) {
+            struct io_uring_sqe *sqe = ring_get_sqe();
+            if (sqe) {
+                sqe->opcode = IORING_OP_POLL_REMOVE;
+                sqe->addr = w->serial;
+                sqe->user_data = 0;
+            }
+            ring_enter(false);
+        }
+    } else {
+        epoll_ctl(loop_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    w->fd = -1;
+}
+
+/**
+ * @brief Call a function once after a delay
+ *
+ * @param ms Delay in milliseconds
+ * @param fn Called with arg
+ * @param arg Passed to fn
+ * @return int Id of the timer, -1 on error with errno set
+ */
+int loop_timer_add(unsigned ms, void (*fn)(void *arg), void *arg) {
+    if (backend == LOOP_NONE) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < LOOP_MAX_TIMERS; i++) {
+        if (timers[i].id == 0) {
+            int id = next_timer_id++;
+            if (next_timer_id <= 0) next_timer_id = 1;
+            timers[i] = (struct loop_timer){ id, loop_now() + (uint64_t)ms * 1000000ULL, fn, arg };
+            timer_rearm();
+            return id;
+        }
+    }
+    errno = ENOSPC;
+    return -1;
+}
+
+/**
+ * @brief Cancel a timer that has not fired
+ *
+ * @param id Id returned by loop_timer_add
+ */
+void loop_timer_cancel(int id) {
+    for (size_t i = 0; i < LOOP_MAX_TIMERS; i++) {
+        if (id > 0 && timers[i].id == id) {
+            timers[i].id = 0;
+            timer_rearm();
+        }
+    }
+}
+
+/**
+ * @brief Call the function of a watch that has input
+ *
+ * @param serial Serial of the watch
+ */
+static void dispatch(uint64_t serial) {
+    for (size_t i = 0; i < LOOP_MAX_WATCHES; i++) {
+        struct loop_watch *w = &watches[i];
+        if (w->fd >= 0 && w->serial == serial) {
+            w->armed = false;
+            w->fn(w->fd, w->arg);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Wait until a descriptor has input or a timer is due and call
+ * the functions for them
+ *
+ * @return int Number of functions called, 0 if a signal interrupted the
+ * wait, -1 on error with errno set
+ */
+int loop_run_once(void) {
+    uint64_t ready[LOOP_MAX_WATCHES];
+    int count = 0;
+
+    if (backend == LOOP_URING) {
+        if (ring_enter(true) < 0) return errno == EINTR ? 0 : -1;
+        unsigned head = *ring.cq_head;
+        unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring.cq_tail, memory_order_acquire);
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            if (cqe->user_data != 0 && cqe->res >= 0 && count < LOOP_MAX_WATCHES) {
+                ready[count++] = cqe->user_data;
+            } else if (cqe->user_data != 0 && cqe->res < 0) {
+                // A failed poll is not pending any more, try it again
+                for (size_t i = 0; i < LOOP_MAX_WATCHES; i++) {
+                    if (watches[i].fd >= 0 && watches[i].serial == cqe->user_data) {
+                        watches[i].armed = false;
+                    }
+                }
+            }
+        }
+        atomic_store_explicit((_Atomic unsigned *)ring.cq_head, head, memory_order_release);
+    } else if (backend == LOOP_EPOLL) {
+        struct epoll_event events[LOOP_MAX_WATCHES];
+        int n = epoll_wait(loop_fd, events, LOOP_MAX_WATCHES, -1);
+        if (n < 0) return errno == EINTR ? 0 : -1;
+        for (int i = 0; i < n; i++) ready[count++] = events[i].data.u64;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Functions may add and remove watches, so they run after the events
+    // were collected. Then every watch that fired is polled again.
+    for (int i = 0; i < count; i++) dispatch(ready[i]);
+    if (backend == LOOP_URING) {
+        for (size_t i = 0; i < LOOP_MAX_WATCHES; i++) {
+            if (watches[i].fd >= 0 && !watches[i].armed) ring_arm(&watches[i]);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,587 @@
+/**
+ * @file ls.c
+ * @author Waylon Walsh
+ * @brief The ls builtin
+ * @date 2026-10-16
+ *
+ * Directories are read with getdents64 into a large buffer, so a
+ * directory with a million entries takes a few hundred system calls
+ * instead of going through readdir one entry at a time. Names are copied
+ * into an arena local to the command, so its memory is returned when the
+ * listing is done, and sorted bytewise with an MSD radix sort, the order
+ * ls gives in the C locale. Output is formatted into one large buffer
+ * and handed to the stream in big chunks. For -l the status of the
+ * entries is fetched with statx by several threads, see ls_stat_entries.
+ *
+ * -a shows entries starting with a dot, -l prints the long format and -U
+ * keeps directory order. With any other option the command is not a
+ * builtin and the external ls runs instead.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include "lab.h"
+
+#define LS_DENTS_SIZE (256 * 1024)  // Buffer for getdents64
+#define LS_OUTPUT_SIZE (256 * 1024) // Output is written in chunks this big
+#define LS_INSERTION_SORT 32        // Smaller buckets are insertion sorted
+#define LS_ID_CACHE 16              // User and group names remembered
+#define LS_SIX_MONTHS (6 * 30 * 24 * 60 * 60L) // Older files show the year
+#define LS_STAT_THREADS 8           // Threads that fetch status for ls -l
+#define LS_STAT_PARALLEL 64         // Entries per thread worth starting it
+#define LS_STAT_BATCH 16            // Entries a thread claims at a time
+// Fields the long format prints
+#define LS_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | \
+                       STATX_SIZE | STATX_BLOCKS | STATX_MTIME)
+
+/**
+ * @brief Options of one ls command
+ */
+struct ls_opts {
+    bool all;      // -a: show names starting with a dot
+    bool longfmt;  // -l: long format
+    bool unsorted; // -U: directory order
+};
+
+/**
+ * @brief A directory entry
+ */
+struct ls_entry {
+    const char *name; // Name, terminated
+    size_t len;       // Length of name
+};
+
+/**
+ * @brief Output buffer in front of the stream
+ */
+struct ls_output {
+    FILE *out;  // Stream the listing goes to
+    char *buf;  // LS_OUTPUT_SIZE bytes
+    size_t len; // Bytes waiting in buf
+};
+
+/**
+ * @brief A user or group name looked up before
+ */
+struct ls_id {
+    unsigned id;    // User or group id
+    char name[32];  // Its name, or the number if it has none
+};
+
+/**
+ * @brief Parse the options of an ls command
+ *
+ * @param argv Array of command arguments
+ * @param opts Receives the options, may be NULL
+ * @return int Index of the first operand, -1 if an option is not supported
+ */
+static int ls_parse_opts(char **argv, struct ls_opts *opts) {
+    struct ls_opts o = { false, false, false };
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *p = argv[i] + 1; *p; p++) {
+            switch (*p) {
+            case 'a':
+                o.all = true;
+                break;
+            case 'l':
+                o.longfmt = true;
+                break;
+            case 'U':
+                o.unsorted = true;
+                break;
+            default:
+                return -1;
+            }
+        }
+    }
+    if (opts) *opts = o;
+    return i;
+}
+
+/**
+ * @brief Check whether the builtin ls supports a command line
+ *
+ * @param argv Array of command arguments
+ * @return true if every option is one the builtin implements
+ */
+bool builtin_ls_accepts(char **argv) {
+    return ls_parse_opts(argv, NULL) >= 0;
+}
+
+/**
+ * @brief Hand the buffered output to the stream
+ *
+ * @param o The output
+ */
+static void ls_flush(struct ls_output *o) {
+    if (o->len > 0) fwrite(o->buf, 1, o->len, o->out);
+    o->len = 0;
+}
+
+/**
+ * @brief Append bytes to the output
+ *
+ * @param o The output
+ * @param data The bytes
+ * @param len Number of bytes
+ */
+static void ls_write(struct ls_output *o, const char *data, size_t len) {
+    if (len > LS_OUTPUT_SIZE - o->len) {
+        ls_flush(o);
+        if (len > LS_OUTPUT_SIZE) {
+            fwrite(data, 1, len, o->out);
+            return;
+        }
+    }
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+}
+
+/**
+ * @brief Byte of a name at a depth, 0 past its end
+ *
+ * @param e The entry
+ * @param depth Offset into the name
+ * @return unsigned The byte
+ */
+static inline unsigned ls_byte(const struct ls_entry *e, size_t depth) {
+    return depth < e->len ? (unsigned char)e->name[depth] : 0;
+}
+
+/**
+ * @brief Sort entries by name, all sharing their first depth bytes
+ *
+ * @param v The entries
+ * @param n Number of entries
+ * @param depth Length of the common prefix
+ * @param tmp Scratch space for n entries
+ */
+static void ls_radix_sort(struct ls_entry *v, size_t n, size_t depth, struct ls_entry *tmp) {
+    if (n < LS_INSERTION_SORT) {
+        for (size_t i = 1; i < n; i++) {
+            struct ls_entry e = v[i];
+            size_t j = i;
+            while (j > 0 && strcmp(v[j - 1].name + depth, e.name + depth) > 0) {
+                v[j] = v[j - 1];
+                j--;
+            }
+            v[j] = e;
+        }
+        return;
+    }
+
+    size_t count[256] = { 0 };
+    for (size_t i = 0; i < n; i++) count[ls_byte(&v[i], depth)]++;
+
+    size_t start[256];
+    size_t pos = 0;
+    for (int b = 0; b < 256; b++) {
+        start[b] = pos;
+        pos += count[b];
+    }
+    for (size_t i = 0; i < n; i++) tmp[start[ls_byte(&v[i], depth)]++] = v[i];
+    memcpy(v, tmp, n * sizeof(*v));
+
+    // Names that ended at depth are equal, every other bucket goes a byte deeper
+    pos = count[0];
+    for (int b = 1; b < 256; b++) {
+        if (count[b] > 1) ls_radix_sort(v + pos, count[b], depth + 1, tmp);
+        pos += count[b];
+    }
+}
+
+/**
+ * @brief Read the entries of a directory
+ *
+ * @param fd Descriptor of the directory
+ * @param opts The options
+ * @param a Arena the names are copied into
+ * @param entries Receives the entries, to be freed
+ * @param count Receives the number of entries
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int ls_read_dir(int fd, const struct ls_opts *opts, struct arena *a,
+                       struct ls_entry **entries, size_t *count) {
+    char *buf = malloc(LS_DENTS_SIZE);
+    if (!buf) return -1;
+
+    struct ls_entry *v = NULL;
+    size_t n = 0, size = 0;
+    ssize_t got;
+    while ((got = getdents64(fd, buf, LS_DENTS_SIZE)) > 0) {
+        for (ssize_t pos = 0; pos < got;) {
+            const struct dirent64 *d = (const struct dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+            if (d->d_name[0] == '.' && !opts->all) continue;
+
+            if (n == size) {
+                size = size ? size * 2 : 1024;
+                struct ls_entry *grown = realloc(v, size * sizeof(*v));
+                if (!grown) {
+                    got = -1;
+                    break;
+                }
+                v = grown;
+            }
+            size_t len = strlen(d->d_name);
+            char *name = arena_alloc(a, len + 1);
+            memcpy(name, d->d_name, len + 1);
+            v[n].name = name;
+            v[n].len = len;
+            n++;
+        }
+        if (got < 0) break;
+    }
+
+    int err = errno;
+    free(buf);
+    if (got < 0) {
+        free(v);
+        errno = err;
+        return -1;
+    }
+    *entries = v;
+    *count = n;
+    return 0;
+}
+
+/**
+ * @brief Name of a user or group id, looked up once per command
+ *
+ * @param cache The ids looked up so far
+ * @param id The id
+ * @param group true for a group id
+ * @return const char* The name
+ */
+static const char *ls_id_name(struct ls_id *cache, unsigned id, bool group) {
+    size_t slot = id % LS_ID_CACHE;
+    if (cache[slot].name[0] != '\0' && cache[slot].id == id) return cache[slot].name;
+
+    const char *name = NULL;
+    if (group) {
+        struct group *gr = getgrgid(id);
+        if (gr) name = gr->gr_name;
+    } else {
+        struct passwd *pw = getpwuid(id);
+        if (pw) name = pw->pw_name;
+    }
+    cache[slot].id = id;
+    if (name) {
+        snprintf(cache[slot].name, sizeof(cache[slot].name), "%s", name);
+    } else {
+        snprintf(cache[slot].name, sizeof(cache[slot].name), "%u", id);
+    }
+    return cache[slot].name;
+}
+
+/**
+ * @brief Format the permission bits like ls -l
+ *
+ * @param mode The mode
+ * @param s Receives 10 characters and a terminator
+ */
+static void ls_mode_string(mode_t mode, char *s) {
+    s[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISCHR(mode) ? 'c' :
+           S_ISBLK(mode) ? 'b' : S_ISFIFO(mode) ? 'p' : S_ISSOCK(mode) ? 's' : '-';
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) s[i + 1] = (mode & (0400 >> i)) ? rwx[i] : '-';
+    if (mode & S_ISUID) s[3] = (mode & S_IXUSR) ? 's' : 'S';
+    if (mode & S_ISGID) s[6] = (mode & S_IXGRP) ? 's' : 'S';
+    if (mode & S_ISVTX) s[9] = (mode & S_IXOTH) ? 't' : 'T';
+    s[10] = '\0';
+}
+
+/**
+ * @brief Entries whose status is fetched by a group of threads
+ */
+struct ls_stat_job {
+    int dirfd;                 // Directory holding the entries
+    const struct ls_entry *v;  // The entries
+    size_t n;                  // Number of entries
+    struct statx *st;          // Receives the status of each entry
+    int *err;                  // Receives 0 or the errno of each entry
+    atomic_size_t next;        // First entry no thread has claimed
+};
+
+/**
+ * @brief Fetch the status of the entries until none are left
+ *
+ * Entries are claimed in batches, and every result goes to the slot of
+ * its entry, so the order of the listing does not depend on which thread
+ * finishes first.
+ *
+ * @param arg The struct ls_stat_job
+ * @return void* NULL
+ */
+static void *ls_stat_worker(void *arg) {
+    struct ls_stat_job *job = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next, LS_STAT_BATCH);
+        if (i >= job->n) break;
+        size_t end = i + LS_STAT_BATCH < job->n ? i + LS_STAT_BATCH : job->n;
+        for (; i < end; i++) {
+            int rc = statx(job->dirfd, job->v[i].name,
+                           AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, LS_STATX_MASK, &job->st[i]);
+            job->err[i] = rc == 0 ? 0 : errno;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get the status of every entry for the long format
+ *
+ * Each statx waits for the file system, which on a network mount or a
+ * cold cache is most of the time ls -l takes. Large directories are
+ * therefore examined by up to LS_STAT_THREADS threads at once. The
+ * threads only live for this call, so the shell never forks while they
+ * exist.
+ *
+ * @param dirfd Directory holding the entries
+ * @param v The entries
+ * @param n Number of entries
+ * @param st Receives the status of each entry
+ * @param err Receives 0 or the errno of each entry
+ */
+static void ls_stat_entries(int dirfd, const struct ls_entry *v, size_t n, struct statx *st,
+                            int *err) {
+    struct ls_stat_job job = { dirfd, v, n, st, err, 0 };
+
+    pthread_t threads[LS_STAT_THREADS - 1];
+    size_t num_threads = 0;
+    if (n >= LS_STAT_PARALLEL) {
+        size_t wanted = n / LS_STAT_PARALLEL;
+        if (wanted > LS_STAT_THREADS - 1) wanted = LS_STAT_THREADS - 1;
+        for (; num_threads < wanted; num_threads++) {
+            if (pthread_create(&threads[num_threads], NULL, ls_stat_worker, &job) != 0) break;
+        }
+    }
+    // This thread works too, and does everything if no thread could start
+    ls_stat_worker(&job);
+    for (size_t i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+}
+
+/**
+ * @brief Print entries in the long format
+ *
+ * @param o The output
+ * @param dirfd Directory holding the entries
+ * @param v The entries, in the order they are printed
+ * @param n Number of entries
+ * @param total Print the total number of blocks first
+ * @return int 0 on success, 1 if an entry could not be examined
+ */
+static int ls_print_long(struct ls_output *o, int dirfd, const struct ls_entry *v, size_t n,
+                         bool total) {
+    struct statx *st = malloc(n * sizeof(*st) + 1);
+    int *err = malloc(n * sizeof(*err) + 1);
+    if (!st || !err) {
+        free(st);
+        free(err);
+        perror("ls");
+        return 1;
+    }
+    ls_stat_entries(dirfd, v, n, st, err);
+
+    // Every column is as wide as its widest value
+    struct ls_id users[LS_ID_CACHE] = { 0 }, groups[LS_ID_CACHE] = { 0 };
+    int w_links = 1, w_user = 1, w_group = 1, w_size = 1;
+    unsigned long long blocks = 0;
+    char num[64];
+    for (size_t i = 0; i < n; i++) {
+        if (err[i]) continue;
+        int w = snprintf(num, sizeof(num), "%lu", (unsigned long)st[i].stx_nlink);
+        if (w > w_links) w_links = w;
+        w = (int)strlen(ls_id_name(users, st[i].stx_uid, false));
+        if (w > w_user) w_user = w;
+        w = (int)strlen(ls_id_name(groups, st[i].stx_gid, true));
+        if (w > w_group) w_group = w;
+        if (S_ISCHR(st[i].stx_mode) || S_ISBLK(st[i].stx_mode)) {
+            w = snprintf(num, sizeof(num), "%u, %u", st[i].stx_rdev_major, st[i].stx_rdev_minor);
+        } else {
+            w = snprintf(num, sizeof(num), "%lld", (long long)st[i].stx_size);
+        }
+        if (w > w_size) w_size = w;
+        blocks += ((unsigned long long)st[i].stx_blocks + 1) / 2;
+    }
+
+    char line[PATH_MAX * 2 + 256];
+    if (total) {
+        int len = snprintf(line, sizeof(line), "total %llu\n", blocks);
+        ls_write(o, line, (size_t)len);
+    }
+
+    int status = 0;
+    time_t now = time(NULL);
+    for (size_t i = 0; i < n; i++) {
+        if (err[i]) {
+            fprintf(stderr, "ls: %s: %s\n", v[i].name, strerror(err[i]));
+            status = 1;
+            continue;
+        }
+        char mode[11];
+        ls_mode_string(st[i].stx_mode, mode);
+        if (S_ISCHR(st[i].stx_mode) || S_ISBLK(st[i].stx_mode)) {
+            snprintf(num, sizeof(num), "%u, %u", st[i].stx_rdev_major, st[i].stx_rdev_minor);
+        } else {
+            snprintf(num, sizeof(num), "%lld", (long long)st[i].stx_size);
+        }
+
+        struct tm tm;
+        char date[32];
+        time_t mtime = (time_t)st[i].stx_mtime.tv_sec;
+        localtime_r(&mtime, &tm);
+        bool recent = mtime <= now && now - mtime < LS_SIX_MONTHS;
+        strftime(date, sizeof(date), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+
+        int len = snprintf(line, sizeof(line), "%s %*lu %-*s %-*s %*s %s %s", mode, w_links,
+                           (unsigned long)st[i].stx_nlink, w_user,
+                           ls_id_name(users, st[i].stx_uid, false), w_group,
+                           ls_id_name(groups, st[i].stx_gid, true), w_size, num, date, v[i].name);
+        if (len < 0 || (size_t)len >= sizeof(line)) continue;
+        if (S_ISLNK(st[i].stx_mode)) {
+            char target[PATH_MAX];
+            ssize_t t = readlinkat(dirfd, v[i].name, target, sizeof(target) - 1);
+            if (t >= 0) {
+                len += snprintf(line + len, sizeof(line) - (size_t)len, " -> %.*s", (int)t,
+                                target);
+            }
+        }
+        line[len++] = '\n';
+        ls_write(o, line, (size_t)len);
+    }
+    free(st);
+    free(err);
+    return status;
+}
+
+/**
+ * @brief List one directory
+ *
+ * @param o The output
+ * @param path The directory
+ * @param opts The options
+ * @return int 0 on success, 1 on failure
+ */
+static int ls_list_dir(struct ls_output *o, const char *path, const struct ls_opts *opts) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct arena names = { 0 };
+    struct ls_entry *v = NULL;
+    size_t n = 0;
+    if (ls_read_dir(fd, opts, &names, &v, &n) < 0) {
+        fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+        arena_destroy(&names);
+        close(fd);
+        return 1;
+    }
+
+    int status = 0;
+    if (!opts->unsorted && n > 1) {
+        struct ls_entry *tmp = malloc(n * sizeof(*tmp));
+        if (tmp) {
+            ls_radix_sort(v, n, 0, tmp);
+            free(tmp);
+        }
+    }
+    if (opts->longfmt) {
+        status = ls_print_long(o, fd, v, n, true);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            // The terminator is overwritten by the newline
+            char *name = (char *)v[i].name;
+            name[v[i].len] = '\n';
+            ls_write(o, name, v[i].len + 1);
+        }
+    }
+
+    free(v);
+    arena_destroy(&names);
+    close(fd);
+    return status;
+}
+
+/**
+ * @brief Run the ls builtin
+ *
+ * With no operands the current directory is listed. A directory operand
+ * is listed, any other operand is printed like an entry of a directory.
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int 0 on success, 1 if an operand could not be listed
+ */
+int builtin_ls(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(sh)
+    struct ls_opts opts;
+    int first = ls_parse_opts(argv, &opts);
+    if (first < 0) return 2;
+
+    struct ls_output o = { out, malloc(LS_OUTPUT_SIZE), 0 };
+    if (!o.buf) {
+        perror("ls");
+        return 1;
+    }
+
+    int status = 0;
+    int operands = 0;
+    while (argv[first + operands] != NULL) operands++;
+    if (operands == 0) {
+        status = ls_list_dir(&o, ".", &opts);
+    }
+    for (int i = 0; i < operands; i++) {
+        const char *path = argv[first + i];
+        struct stat st;
+        if (stat(path, &st) < 0 && lstat(path, &st) < 0) {
+            fprintf(stderr, "ls: %s: %s\n", path, strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            struct ls_entry e = { path, strlen(path) };
+            if (opts.longfmt) {
+                status |= ls_print_long(&o, AT_FDCWD, &e, 1, false);
+            } else {
+                ls_write(&o, path, e.len);
+                ls_write(&o, "\n", 1);
+            }
+            continue;
+        }
+
+        if (operands > 1) {
+            if (i > 0) ls_write(&o, "\n", 1);
+            ls_write(&o, path, strlen(path));
+            ls_write(&o, ":\n", 2);
+        }
+        status |= ls_list_dir(&o, path, &opts);
+    }
+
+    ls_flush(&o);
+    fflush(out);
+    free(o.buf);
+    return status;
+}
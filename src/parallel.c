@@ -0,0 +1,249 @@
+/**
+ * @file parallel.c
+ * @author Waylon Walsh
+ * @brief The parallel builtin
+ * @date 2026-10-16
+ *
+ * parallel runs many independent commands with at most -j of them alive
+ * at a time. Each command is started with start_job as an ordinary
+ * background job, so it takes a slot of the job table and is reaped by
+ * the same machinery as any job started with &. The scheduler keeps every
+ * worker slot busy: as soon as wait_for_any_job reports that a job
+ * finished, the next command takes its slot, so a slow command never
+ * holds up the ones queued behind the others.
+ *
+ * The commands come from the arguments after ::: or from the lines of
+ * standard input. With a command in front of them every input is one
+ * argument, substituted for {} or appended at the end. Without one every
+ * input is a command line of its own and may be a pipeline. The status of
+ * each job is kept, the ones that failed are listed when all are done.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "lab.h"
+
+#define PARALLEL_SEPARATOR ":::"   // Starts the list of inputs
+#define PARALLEL_PLACEHOLDER "{}"  // Replaced by the input in the command
+#define PARALLEL_READ_SIZE 65536   // Bytes read from standard input at a time
+#define PARALLEL_MAX_STATUS 101    // Status cap for failed jobs
+#define PARALLEL_USAGE_STATUS 255  // Status of a usage error
+
+/**
+ * @brief Print the usage of parallel
+ *
+ * @return int The status for a usage error
+ */
+static int parallel_usage(void) {
+    fprintf(stderr, "parallel: usage: parallel [-j jobs] [command [args]] [::: inputs]\n");
+    return PARALLEL_USAGE_STATUS;
+}
+
+/**
+ * @brief Read the lines of standard input
+ *
+ * @param a The arena the lines are copied to
+ * @param count Receives the number of lines
+ * @return char** The lines without empty ones, NULL on a read error
+ */
+static char **parallel_read_lines(struct arena *a, size_t *count) {
+    size_t size = 0, cap = PARALLEL_READ_SIZE;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+
+    // read(2) so nothing stdio has buffered from the shell's input is used
+    for (;;) {
+        if (cap - size < PARALLEL_READ_SIZE) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(STDIN_FILENO, buf + size, PARALLEL_READ_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("parallel");
+            free(buf);
+            return NULL;
+        }
+        if (n == 0) break;
+        size += (size_t)n;
+    }
+
+    size_t lines = 1;
+    for (size_t i = 0; i < size; i++) {
+        if (buf[i] == '\n') lines++;
+    }
+    char **out = arena_alloc(a, lines * sizeof(char *));
+    *count = 0;
+    for (size_t start = 0; start < size;) {
+        char *nl = memchr(buf + start, '\n', size - start);
+        size_t end = nl ? (size_t)(nl - buf) : size;
+        if (end > start) {
+            char *line = arena_alloc(a, end - start + 1);
+            memcpy(line, buf + start, end - start);
+            line[end - start] = '\0';
+            out[(*count)++] = line;
+        }
+        start = end + 1;
+    }
+    free(buf);
+    return out;
+}
+
+/**
+ * @brief Substitute an input for every {} in a word
+ *
+ * @param a The arena to allocate from
+ * @param word The word of the command
+ * @param input The input
+ * @return char* The word with the input substituted
+ */
+static char *parallel_substitute(struct arena *a, const char *word, const char *input) {
+    size_t holes = 0;
+    for (const char *p = strstr(word, PARALLEL_PLACEHOLDER); p; p = strstr(p + 2, PARALLEL_PLACEHOLDER)) {
+        holes++;
+    }
+    size_t input_len = strlen(input);
+    char *out = arena_alloc(a, strlen(word) + holes * input_len + 1);
+
+    char *o = out;
+    const char *p = word;
+    for (const char *hole; (hole = strstr(p, PARALLEL_PLACEHOLDER)) != NULL; p = hole + 2) {
+        memcpy(o, p, (size_t)(hole - p));
+        o += hole - p;
+        memcpy(o, input, input_len);
+        o += input_len;
+    }
+    strcpy(o, p);
+    return out;
+}
+
+/**
+ * @brief Build the argument vector that runs one input
+ *
+ * @param a The arena to allocate from
+ * @param cmd The command in front of the inputs, NULL terminated, may be
+ * empty
+ * @param input The input
+ * @return char** The argument vector, NULL if the input is an empty line
+ */
+static char **parallel_command(struct arena *a, char **cmd, const char *input) {
+    if (cmd[0] == NULL) return cmd_parse_arena(a, input);
+
+    size_t n = 0;
+    bool substituted = false;
+    while (cmd[n] != NULL) {
+        if (strstr(cmd[n], PARALLEL_PLACEHOLDER)) substituted = true;
+        n++;
+    }
+
+    char **argv = arena_alloc(a, (n + 2) * sizeof(char *));
+    for (size_t i = 0; i < n; i++) {
+        argv[i] = substituted ? parallel_substitute(a, cmd[i], input) : cmd[i];
+    }
+    if (!substituted) argv[n++] = (char *)input;
+    argv[n] = NULL;
+    return argv;
+}
+
+/**
+ * @brief Run the parallel builtin
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to, the jobs write to standard
+ * output directly
+ * @return int The number of jobs that failed, at most 101, or 255 on a
+ * usage error
+ */
+int builtin_parallel(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(out)
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strncmp(argv[i], "-j", 2) != 0) return parallel_usage();
+
+        const char *value = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+        char *end;
+        if (value == NULL) return parallel_usage();
+        max_jobs = strtol(value, &end, 10);
+        if (*end != '\0' || max_jobs < 1 || max_jobs > INT_MAX / 2) return parallel_usage();
+    }
+    if (max_jobs < 1) max_jobs = 1;
+
+    // The command ends at the separator, the inputs follow it
+    char **cmd = &argv[i];
+    char **inputs = NULL;
+    size_t num_inputs = 0;
+    for (; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], PARALLEL_SEPARATOR) == 0) {
+            argv[i] = NULL;
+            inputs = &argv[i + 1];
+            while (inputs[num_inputs] != NULL) num_inputs++;
+            break;
+        }
+    }
+    if (inputs == NULL) {
+        inputs = parallel_read_lines(&sh->arena, &num_inputs);
+        if (inputs == NULL) return 1;
+    }
+    if (num_inputs == 0) return 0;
+
+    size_t workers = num_inputs < (size_t)max_jobs ? num_inputs : (size_t)max_jobs;
+    int *running = arena_alloc(&sh->arena, workers * sizeof(int));     // Job of each worker
+    size_t *running_input = arena_alloc(&sh->arena, workers * sizeof(size_t));
+    int *statuses = arena_alloc(&sh->arena, num_inputs * sizeof(int));
+    memset(running, 0, workers * sizeof(int));
+
+    size_t next = 0, active = 0;
+    while (next < num_inputs || active > 0) {
+        for (size_t w = 0; w < workers && next < num_inputs; w++) {
+            while (running[w] == 0 && next < num_inputs) {
+                size_t k = next++;
+                char **job_argv = parallel_command(&sh->arena, cmd, inputs[k]);
+                int id = start_job(job_argv, sh, &statuses[k]);
+                if (id > 0) {
+                    running[w] = id;
+                    running_input[w] = k;
+                    active++;
+                }
+            }
+        }
+        if (active == 0) continue;
+
+        int status;
+        int w = wait_for_any_job(running, (int)workers, &status);
+        if (w < 0) {
+            // The jobs left the table without us, their status is lost
+            for (size_t j = 0; j < workers; j++) {
+                if (running[j] != 0) statuses[running_input[j]] = 1;
+                running[j] = 0;
+            }
+            active = 0;
+            continue;
+        }
+        statuses[running_input[w]] = status;
+        running[w] = 0;
+        active--;
+    }
+
+    int failed = 0;
+    for (size_t k = 0; k < num_inputs; k++) {
+        if (statuses[k] == 0) continue;
+        fprintf(stderr, "parallel: %s: exit status %d\n", inputs[k], statuses[k]);
+        failed++;
+    }
+    return failed < PARALLEL_MAX_STATUS ? failed : PARALLEL_MAX_STATUS;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file phase.c
+ * @author Waylon Walsh
+ * @brief Time spent in each phase of running a command line
+ * @date 2026-10-16
+ *
+ * The shell adds up how long it spends parsing a line, starting its
+ * processes, running them and getting their status back, so the time
+ * builtin can tell the shell's overhead apart from the time the program
+ * itself ran. sh_eval_view resets the totals at the start of every line,
+ * along with the resource usage jobs.c sums for the jobs of the line.
+ * Reading CLOCK_MONOTONIC goes through the vDSO, so keeping the totals
+ * costs a few dozen nanoseconds per phase.
+ */
+
+#include <time.h>
+#include "lab.h"
+
+static uint64_t phase_ns[NUM_PHASES]; // Time spent in each phase
+
+/**
+ * @brief Read the monotonic clock
+ *
+ * @return uint64_t Nanoseconds since an arbitrary point
+ */
+uint64_t phase_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Start counting for a new command line
+ */
+void phase_reset(void) {
+    for (int i = 0; i < NUM_PHASES; i++) phase_ns[i] = 0;
+    jobs_line_reset();
+}
+
+/**
+ * @brief Add time to a phase
+ *
+ * @param phase The phase
+ * @param ns Nanoseconds spent in it
+ */
+void phase_add(enum shell_phase phase, uint64_t ns) {
+    phase_ns[phase] += ns;
+}
+
+/**
+ * @brief Time spent in a phase since the last reset
+ *
+ * @param phase The phase
+ * @return uint64_t Nanoseconds spent in it
+ */
+uint64_t phase_total_ns(enum shell_phase phase) {
+    return phase_ns[phase];
+}
@@ -0,0 +1,237 @@
+/**
+ * @file redirect.c
+ * @author Waylon Walsh
+ * @brief Input and output redirection
+ * @date 2026-10-16
+ *
+ * Redirections are opened by the shell, not by the child, so a missing
+ * file is reported with its name and the command is not started. Every
+ * descriptor the shell opens is close-on-exec and moved above the range
+ * commands use, so it can only reach a child through the dup2 spawn
+ * actions built here and a later redirection cannot overwrite it before
+ * it is used. Builtins run inside the shell, so for them the same actions
+ * are applied to the shell's own descriptors and undone afterwards.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "lab.h"
+
+#define REDIRECT_FD_BASE 10 // Lowest descriptor the shell keeps redirections on
+
+/**
+ * @brief Parse a redirection operator
+ *
+ * @param token The token to parse
+ * @param r Receives the redirection, target is left unset
+ * @return true if token is a redirection operator
+ */
+bool redirect_parse(const char *token, struct redirect *r) {
+    if (token == NULL) return false;
+
+    const char *p = token;
+    int fd = -1;
+    if (isdigit((unsigned char)*p)) {
+        fd = 0;
+        while (isdigit((unsigned char)*p)) {
+            fd = fd * 10 + (*p++ - '0');
+            if (fd > 0xffff) return false;
+        }
+    }
+
+    enum redirect_type type;
+    if (strcmp(p, "<") == 0) {
+        type = REDIRECT_IN;
+    } else if (strcmp(p, "<&") == 0 || strcmp(p, ">&") == 0) {
+        type = REDIRECT_DUP;
+    } else if (strcmp(p, "<<<") == 0) {
+        type = REDIRECT_STRING;
+    } else if (strcmp(p, ">") == 0) {
+        type = REDIRECT_OUT;
+    } else if (strcmp(p, ">>") == 0) {
+        type = REDIRECT_APPEND;
+    } else {
+        return false;
+    }
+
+    r->type = type;
+    r->fd = fd >= 0 ? fd : (*p == '<' ? STDIN_FILENO : STDOUT_FILENO);
+    r->target = NULL;
+    return true;
+}
+
+/**
+ * @brief Move a descriptor above the range commands use
+ *
+ * @param fd A close-on-exec descriptor, closed by this function
+ * @return int The new descriptor or -1 on error with errno set
+ */
+static int redirect_move_fd(int fd) {
+    if (fd < 0 || fd >= REDIRECT_FD_BASE) return fd;
+
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FD_BASE);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return moved;
+}
+
+/**
+ * @brief Put the contents of a here-string into an unlinked memory file
+ *
+ * @param word The word after <<<
+ * @return int A descriptor positioned at the start or -1 on error
+ */
+static int redirect_here_string(const char *word) {
+    int fd = memfd_create("here-string", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+
+    size_t len = strlen(word);
+    bool ok = write(fd, word, len) == (ssize_t)len && write(fd, "\n", 1) == 1 &&
+              lseek(fd, 0, SEEK_SET) == 0;
+    if (!ok) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Parse the descriptor a duplication redirects to
+ *
+ * @param target The word after <& or >&
+ * @return int The descriptor or -1 if the word is not a number
+ */
+static int redirect_dup_fd(const char *target) {
+    if (*target == '\0') return -1;
+
+    int fd = 0;
+    for (const char *p = target; *p; p++) {
+        if (!isdigit((unsigned char)*p)) return -1;
+        fd = fd * 10 + (*p - '0');
+        if (fd > 0xffff) return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Open the files of a list of redirections
+ *
+ * @param redirs The redirections
+ * @param num_redirs Number of redirections
+ * @param actions Receives one spawn action per redirection
+ * @return int 0 on success, -1 after printing an error
+ */
+int redirect_open(const struct redirect *redirs, size_t num_redirs,
+                  struct spawn_action *actions) {
+    for (size_t i = 0; i < num_redirs; i++) {
+        const struct redirect *r = &redirs[i];
+        int fd = -1;
+
+        switch (r->type) {
+        case REDIRECT_IN:
+            fd = open(r->target, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIRECT_OUT:
+            fd = open(r->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            break;
+        case REDIRECT_APPEND:
+            fd = open(r->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            break;
+        case REDIRECT_STRING:
+            fd = redirect_here_string(r->target);
+            break;
+        case REDIRECT_DUP:
+            fd = redirect_dup_fd(r->target);
+            if (fd < 0) {
+                fprintf(stderr, "shell: %s: ambiguous redirect\n", r->target);
+                redirect_close(redirs, i, actions);
+                return -1;
+            }
+            actions[i] = (struct spawn_action){ r->fd, fd };
+            continue;
+        }
+
+        fd = redirect_move_fd(fd);
+        if (fd < 0) {
+            fprintf(stderr, "shell: %s: %s\n",
+                    r->type == REDIRECT_STRING ? "here-string" : r->target,
+                    strerror(errno));
+            redirect_close(redirs, i, actions);
+            return -1;
+        }
+        actions[i] = (struct spawn_action){ r->fd, fd };
+    }
+    return 0;
+}
+
+/**
+ * @brief Close the descriptors opened by redirect_open
+ *
+ * @param redirs The redirections
+ * @param num_redirs Number of redirections
+ * @param actions The spawn actions filled in by redirect_open
+ */
+void redirect_close(const struct redirect *redirs, size_t num_redirs,
+                    const struct spawn_action *actions) {
+    for (size_t i = 0; i < num_redirs; i++) {
+        // Duplications refer to descriptors the shell does not own
+        if (redirs[i].type != REDIRECT_DUP) close(actions[i].src_fd);
+    }
+}
+
+/**
+ * @brief Apply spawn actions to the shell's own descriptors
+ *
+ * @param actions The actions, applied in order
+ * @param num_actions Number of actions
+ * @param saved Receives a copy of each descriptor that was replaced, -1 if
+ * it was not open
+ * @return int 0 on success, -1 after printing an error, nothing is left
+ * applied in that case
+ */
+int redirect_apply(const struct spawn_action *actions, size_t num_actions, int *saved) {
+    for (size_t i = 0; i < num_actions; i++) {
+        saved[i] = fcntl(actions[i].fd, F_DUPFD_CLOEXEC, REDIRECT_FD_BASE);
+        if (saved[i] < 0 && errno != EBADF) {
+            perror("shell");
+            redirect_restore(actions, i, saved);
+            return -1;
+        }
+        if (dup2(actions[i].src_fd, actions[i].fd) < 0) {
+            fprintf(stderr, "shell: %d: %s\n", actions[i].src_fd, strerror(errno));
+            redirect_restore(actions, i + 1, saved);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Undo redirect_apply
+ *
+ * @param actions The actions that were applied
+ * @param num_actions Number of actions
+ * @param saved The descriptors saved by redirect_apply
+ */
+void redirect_restore(const struct spawn_action *actions, size_t num_actions,
+                      const int *saved) {
+    // Undo in reverse so a descriptor redirected twice gets its original back
+    for (size_t i = num_actions; i-- > 0;) {
+        if (saved[i] >= 0) {
+            dup2(saved[i], actions[i].fd);
+            close(saved[i]);
+        } else {
+            close(actions[i].fd);
+        }
+    }
+}
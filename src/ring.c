@@ -0,0 +1,269 @@
+/**
+ * @file ring.c
+ * @author Waylon Walsh
+ * @brief Bounded history of the session
+ * @date 2026-10-16
+ *
+ * The history a session keeps in memory is a ring of HISTSIZE slots, so
+ * a session that runs for weeks uses as much memory for it as one that
+ * just started. Adding a line to a full ring overwrites the oldest one.
+ *
+ * Each line is remembered by a 64-bit FNV-1a digest in a hash set that
+ * maps it to the slot holding it. With consecutive duplicate elimination
+ * a line equal to the newest entry is dropped. With global elimination
+ * the older copy of a line is erased from its slot wherever it is, which
+ * leaves a hole in the ring instead of moving the other entries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "lab.h"
+
+#define NO_SLOT SIZE_MAX
+#define DEFAULT_HISTSIZE 1000 // Lines kept when HISTSIZE is not set
+
+/**
+ * @brief One remembered line
+ */
+struct ring_entry {
+    char *line;      // The line, NULL for an empty or erased slot
+    uint64_t seq;    // Number of the entry, as used by !n
+    uint64_t digest; // Digest of line
+};
+
+/**
+ * @brief Slot of the digest set
+ */
+struct digest_slot {
+    uint64_t digest; // 0 for an empty slot
+    size_t entry;    // Ring slot holding the line
+};
+
+static struct ring_entry *ring = NULL;        // The entries
+static size_t ring_size = 0;                  // Number of slots in the ring
+static size_t ring_next = 0;                  // Slot the next line goes in
+static size_t ring_newest = NO_SLOT;          // Slot of the newest entry
+static uint64_t ring_seq = 0;                 // Last number handed out
+static enum hist_dedup ring_dedup = HIST_DEDUP_NONE;
+static struct digest_slot *digests = NULL;    // Open addressing set
+static size_t digests_size = 0;               // Power of two, twice ring_size
+
+/**
+ * @brief FNV-1a digest of a line
+ *
+ * @param line The line
+ * @return uint64_t The digest, never 0
+ */
+static uint64_t line_digest(const char *line) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)line; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+/**
+ * @brief Find the set slot holding a digest, or the empty slot for it
+ *
+ * @param digest The digest
+ * @return size_t Index into digests
+ */
+static size_t digest_find(uint64_t digest) {
+    size_t mask = digests_size - 1;
+    size_t i = digest & mask;
+    while (digests[i].digest != 0 && digests[i].digest != digest) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Remove the digest in set slot i, shifting its probe run back
+ *
+ * @param i Index of an occupied slot
+ */
+static void digest_remove_slot(size_t i) {
+    size_t mask = digests_size - 1;
+    digests[i].digest = 0;
+
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (digests[j].digest == 0) break;
+        size_t home = digests[j].digest & mask;
+        bool in_range = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!in_range) {
+            digests[i] = digests[j];
+            digests[j].digest = 0;
+            i = j;
+        }
+    }
+}
+
+/**
+ * @brief Empty a ring slot
+ *
+ * @param entry Index of the ring slot
+ */
+static void ring_erase(size_t entry) {
+    struct ring_entry *e = &ring[entry];
+    if (e->line == NULL) return;
+
+    size_t i = digest_find(e->digest);
+    // Only the newest copy of a line is in the set
+    if (digests[i].digest != 0 && digests[i].entry == entry) {
+        digest_remove_slot(i);
+    }
+    free(e->line);
+    e->line = NULL;
+}
+
+/**
+ * @brief Create the history ring
+ *
+ * @param capacity Number of lines kept
+ * @param dedup Which duplicates are eliminated
+ * @return int 0 on success, -1 on error with errno set
+ */
+int hist_ring_init(size_t capacity, enum hist_dedup dedup) {
+    hist_ring_destroy();
+    if (capacity == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t set_size = 1;
+    while (set_size < capacity * 2) set_size *= 2;
+
+    ring = calloc(capacity, sizeof(struct ring_entry));
+    digests = calloc(set_size, sizeof(struct digest_slot));
+    if (!ring || !digests) {
+        hist_ring_destroy();
+        errno = ENOMEM;
+        return -1;
+    }
+    ring_size = capacity;
+    digests_size = set_size;
+    ring_dedup = dedup;
+    return 0;
+}
+
+/**
+ * @brief Create the history ring as configured by the environment
+ *
+ * HISTSIZE is the number of lines kept. HISTCONTROL is a colon separated
+ * list as in bash: ignoredups drops a line equal to the previous one,
+ * erasedups removes every older copy of a line, ignoreboth is the same as
+ * ignoredups here.
+ *
+ * @return int 0 on success, -1 on error with errno set
+ */
+int hist_ring_init_env(void) {
+    size_t capacity = DEFAULT_HISTSIZE;
+    const char *size = getenv("HISTSIZE");
+    if (size != NULL && *size != '\0') {
+        char *end;
+        unsigned long long n = strtoull(size, &end, 10);
+        if (*end == '\0' && n > 0 && n <= SIZE_MAX / 2) capacity = (size_t)n;
+    }
+
+    enum hist_dedup dedup = HIST_DEDUP_NONE;
+    const char *control = getenv("HISTCONTROL");
+    if (control != NULL) {
+        if (strstr(control, "ignoredups") || strstr(control, "ignoreboth")) {
+            dedup = HIST_DEDUP_CONSECUTIVE;
+        }
+        if (strstr(control, "erasedups")) dedup = HIST_DEDUP_ALL;
+    }
+    return hist_ring_init(capacity, dedup);
+}
+
+/**
+ * @brief Number of lines the history ring keeps
+ *
+ * @return size_t The capacity, 0 if the ring was not created
+ */
+size_t hist_ring_capacity(void) {
+    return ring_size;
+}
+
+/**
+ * @brief Free the history ring
+ */
+void hist_ring_destroy(void) {
+    for (size_t i = 0; ring != NULL && i < ring_size; i++) {
+        free(ring[i].line);
+    }
+    free(ring);
+    free(digests);
+    ring = NULL;
+    digests = NULL;
+    ring_size = 0;
+    digests_size = 0;
+    ring_next = 0;
+    ring_newest = NO_SLOT;
+    ring_seq = 0;
+}
+
+/**
+ * @brief Add a line to the history ring
+ *
+ * @param line The line
+ * @param seq Number of the entry, 0 to number it after the newest entry
+ * @return int 1 if the line was added, 0 if it was dropped as a duplicate,
+ * -1 on error with errno set
+ */
+int hist_ring_add(const char *line, uint64_t seq) {
+    if (ring == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t digest = line_digest(line);
+    size_t i = digest_find(digest);
+    bool seen = digests[i].digest != 0 && strcmp(ring[digests[i].entry].line, line) == 0;
+
+    if (seen && ring_dedup == HIST_DEDUP_CONSECUTIVE && digests[i].entry == ring_newest) {
+        return 0;
+    }
+    if (seen && ring_dedup == HIST_DEDUP_ALL) {
+        ring_erase(digests[i].entry);
+    }
+
+    char *copy = strdup(line);
+    if (!copy) return -1;
+
+    // Overwrite the oldest entry when the ring is full
+    ring_erase(ring_next);
+    struct ring_entry *e = &ring[ring_next];
+    e->line = copy;
+    e->seq = seq ? seq : ring_seq + 1;
+    e->digest = digest;
+    ring_seq = e->seq;
+
+    // The set points at the newest copy, a colliding digest is replaced
+    i = digest_find(digest);
+    digests[i].digest = digest;
+    digests[i].entry = ring_next;
+
+    ring_newest = ring_next;
+    ring_next = (ring_next + 1) % ring_size;
+    return 1;
+}
+
+/**
+ * @brief Call a function for every entry, oldest first
+ *
+ * @param fn Function called with the number and text of each entry
+ * @param arg Passed through to fn
+ */
+void hist_ring_foreach(void (*fn)(uint64_t seq, const char *line, void *arg), void *arg) {
+    for (size_t k = 0; k < ring_size; k++) {
+        const struct ring_entry *e = &ring[(ring_next + k) % ring_size];
+        if (e->line != NULL) fn(e->seq, e->line, arg);
+    }
+}
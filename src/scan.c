@@ -0,0 +1,370 @@
+/**
+ * @file scan.c
+ * @author Waylon Walsh
+ * @brief Vectorized whitespace classification used by the parser
+ * @date 2026-10-16
+ *
+ * cmd_parse and trim_white spend their time asking "where does the next
+ * run of delimiters start or stop". These helpers classify 16 (SSE2) or
+ * 32 (AVX2) bytes per instruction and fall back to a table lookup per byte for
+ * short tails and for machines without the vector units. The widest
+ * implementation the CPU supports is picked once at startup.
+ *
+ * The vector loops never read past the end pointer they are given, so
+ * they are safe on buffers that are not padded and under AddressSanitizer.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include "lab.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+// Byte classes indexed by enum scan_class
+static const bool scan_tables[2][256] = {
+    [SCAN_ARG_DELIMS] = {
+        [' '] = true, ['\t'] = true, ['\r'] = true, ['\n'] = true, ['\a'] = true,
+    },
+    [SCAN_SPACE] = {
+        [' '] = true, ['\t'] = true, ['\n'] = true, ['\v'] = true, ['\f'] = true, ['\r'] = true,
+    },
+};
+
+/**
+ * @brief Function table for one implementation
+ */
+struct scan_ops {
+    size_t (*split)(enum scan_class cls, const char *buf, size_t len, char **tokens);
+    const char *(*skip)(enum scan_class cls, const char *p, const char *end);
+    const char *(*find)(enum scan_class cls, const char *p, const char *end);
+    const char *(*rskip)(enum scan_class cls, const char *start, const char *p);
+};
+
+/*
+ * Splitting works on 64 byte blocks. For each block the implementation
+ * builds a mask with one bit per byte in the class, a token starts where a
+ * clear bit follows a set bit and ends where a set bit follows a clear one.
+ * When tokens is NULL the starts are only counted and buf is not written.
+ */
+#define SPLIT_BLOCKS(cls, buf, len, tokens, mask64)                           \
+    size_t count = 0;                                                          \
+    uint64_t prev = 1; /* the byte before buf counts as a delimiter */         \
+    size_t i = 0;                                                              \
+    for (; len - i >= 64; i += 64) {                                           \
+        uint64_t d = mask64(cls, buf + i);                                     \
+        uint64_t shifted = (d << 1) | prev;                                    \
+        uint64_t starts = ~d & shifted;                                        \
+        prev = d >> 63;                                                        \
+        if (tokens == NULL) {                                                  \
+            count += (size_t)__builtin_popcountll(starts);                     \
+            continue;                                                          \
+        }                                                                      \
+        for (uint64_t ends = d & ~shifted; ends; ends &= ends - 1) {           \
+            ((char *)buf)[i + (size_t)__builtin_ctzll(ends)] = '\0';           \
+        }                                                                      \
+        for (; starts; starts &= starts - 1) {                                 \
+            tokens[count++] = (char *)buf + i + __builtin_ctzll(starts);       \
+        }                                                                      \
+    }                                                                          \
+    return count + scalar_split_tail(cls, buf, i, len, prev, tokens, count)
+
+/**
+ * @brief Finish splitting one byte at a time
+ *
+ * @param cls The delimiter class
+ * @param buf The text being split
+ * @param i Offset of the first byte not processed yet
+ * @param len Length of the text
+ * @param prev Whether the byte before offset i is a delimiter
+ * @param tokens Token array or NULL to only count
+ * @param count Number of tokens found so far
+ * @return size_t Number of tokens found from offset i on
+ */
+static inline size_t scalar_split_tail(enum scan_class cls, const char *buf, size_t i,
+                                       size_t len, bool prev, char **tokens, size_t count) {
+    const bool *table = scan_tables[cls];
+    size_t found = 0;
+    for (; i < len; i++) {
+        bool d = table[(unsigned char)buf[i]];
+        if (!d && prev) {
+            if (tokens) tokens[count + found] = (char *)buf + i;
+            found++;
+        } else if (d && !prev && tokens) {
+            ((char *)buf)[i] = '\0';
+        }
+        prev = d;
+    }
+    return found;
+}
+
+/* Scalar implementation */
+
+static size_t scalar_split(enum scan_class cls, const char *buf, size_t len, char **tokens) {
+    return scalar_split_tail(cls, buf, 0, len, true, tokens, 0);
+}
+
+static const char *scalar_skip(enum scan_class cls, const char *p, const char *end) {
+    const bool *table = scan_tables[cls];
+    while (p < end && table[(unsigned char)*p]) p++;
+    return p;
+}
+
+static const char *scalar_find(enum scan_class cls, const char *p, const char *end) {
+    const bool *table = scan_tables[cls];
+    while (p < end && !table[(unsigned char)*p]) p++;
+    return p;
+}
+
+static const char *scalar_rskip(enum scan_class cls, const char *start, const char *p) {
+    const bool *table = scan_tables[cls];
+    while (p > start && table[(unsigned char)p[-1]]) p--;
+    return p;
+}
+
+static const struct scan_ops scalar_ops = { scalar_split, scalar_skip, scalar_find, scalar_rskip };
+
+#ifdef HAVE_X86_SIMD
+
+/* SSE2 implementation, a set bit in the mask marks a byte of the class */
+
+__attribute__((target("sse2")))
+static inline unsigned sse2_mask(enum scan_class cls, const char *p) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    // '\t' '\n' '\v' '\f' '\r' are the contiguous range 9..13
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    if (cls == SCAN_SPACE) {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t));
+    } else {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(1)), t));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\a')));
+    }
+    return (unsigned)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static inline uint64_t sse2_mask64(enum scan_class cls, const char *p) {
+    return (uint64_t)sse2_mask(cls, p) |
+           (uint64_t)sse2_mask(cls, p + 16) << 16 |
+           (uint64_t)sse2_mask(cls, p + 32) << 32 |
+           (uint64_t)sse2_mask(cls, p + 48) << 48;
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_split(enum scan_class cls, const char *buf, size_t len, char **tokens) {
+    SPLIT_BLOCKS(cls, buf, len, tokens, sse2_mask64);
+}
+
+__attribute__((target("sse2")))
+static const char *sse2_skip(enum scan_class cls, const char *p, const char *end) {
+    for (; end - p >= 16; p += 16) {
+        unsigned m = ~sse2_mask(cls, p) & 0xffff;
+        if (m) return p + __builtin_ctz(m);
+    }
+    return scalar_skip(cls, p, end);
+}
+
+__attribute__((target("sse2")))
+static const char *sse2_find(enum scan_class cls, const char *p, const char *end) {
+    for (; end - p >= 16; p += 16) {
+        unsigned m = sse2_mask(cls, p);
+        if (m) return p + __builtin_ctz(m);
+    }
+    return scalar_find(cls, p, end);
+}
+
+__attribute__((target("sse2")))
+static const char *sse2_rskip(enum scan_class cls, const char *start, const char *p) {
+    for (; p - start >= 16; p -= 16) {
+        unsigned m = ~sse2_mask(cls, p - 16) & 0xffff;
+        if (m) return p - 16 + (32 - __builtin_clz(m));
+    }
+    return scalar_rskip(cls, start, p);
+}
+
+static const struct scan_ops sse2_ops = { sse2_split, sse2_skip, sse2_find, sse2_rskip };
+
+/* AVX2 implementation */
+
+__attribute__((target("avx2")))
+static inline uint32_t avx2_mask(enum scan_class cls, const char *p) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    if (cls == SCAN_SPACE) {
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t));
+    } else {
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(1)), t));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\a')));
+    }
+    return (uint32_t)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t avx2_mask64(enum scan_class cls, const char *p) {
+    return (uint64_t)avx2_mask(cls, p) | (uint64_t)avx2_mask(cls, p + 32) << 32;
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_split(enum scan_class cls, const char *buf, size_t len, char **tokens) {
+    SPLIT_BLOCKS(cls, buf, len, tokens, avx2_mask64);
+}
+
+__attribute__((target("avx2")))
+static const char *avx2_skip(enum scan_class cls, const char *p, const char *end) {
+    for (; end - p >= 32; p += 32) {
+        uint32_t m = ~avx2_mask(cls, p);
+        if (m) return p + __builtin_ctz(m);
+    }
+    return sse2_skip(cls, p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *avx2_find(enum scan_class cls, const char *p, const char *end) {
+    for (; end - p >= 32; p += 32) {
+        uint32_t m = avx2_mask(cls, p);
+        if (m) return p + __builtin_ctz(m);
+    }
+    return sse2_find(cls, p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *avx2_rskip(enum scan_class cls, const char *start, const char *p) {
+    for (; p - start >= 32; p -= 32) {
+        uint32_t m = ~avx2_mask(cls, p - 32);
+        if (m) return p - 32 + (32 - __builtin_clz(m));
+    }
+    return sse2_rskip(cls, start, p);
+}
+
+static const struct scan_ops avx2_ops = { avx2_split, avx2_skip, avx2_find, avx2_rskip };
+
+#endif
+
+static const struct scan_ops *scan_ops = &scalar_ops;
+
+/**
+ * @brief Select the scan implementation
+ *
+ * @param impl The implementation to use, SCAN_IMPL_AUTO picks the widest
+ * one the CPU supports
+ * @return int 0 on success, -1 with errno set to ENOTSUP if the CPU lacks
+ * the instructions
+ */
+int scan_set_impl(enum scan_impl impl) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    bool has_sse2 = __builtin_cpu_supports("sse2");
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+#else
+    bool has_sse2 = false;
+    bool has_avx2 = false;
+#endif
+
+    const struct scan_ops *ops = NULL;
+    switch (impl) {
+        case SCAN_IMPL_AUTO:
+            ops = &scalar_ops;
+#ifdef HAVE_X86_SIMD
+            if (has_avx2) ops = &avx2_ops;
+            else if (has_sse2) ops = &sse2_ops;
+#endif
+            break;
+        case SCAN_IMPL_SCALAR:
+            ops = &scalar_ops;
+            break;
+        case SCAN_IMPL_SSE2:
+#ifdef HAVE_X86_SIMD
+            if (has_sse2) ops = &sse2_ops;
+#endif
+            break;
+        case SCAN_IMPL_AVX2:
+#ifdef HAVE_X86_SIMD
+            if (has_avx2) ops = &avx2_ops;
+#endif
+            break;
+    }
+
+    if (ops == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    scan_ops = ops;
+    return 0;
+}
+
+/**
+ * @brief Pick the best implementation before main runs
+ */
+__attribute__((constructor))
+static void scan_init(void) {
+    scan_set_impl(SCAN_IMPL_AUTO);
+}
+
+/**
+ * @brief Count the tokens separated by bytes of a class
+ *
+ * @param cls The delimiter class
+ * @param text The text
+ * @param len Length of the text
+ * @return size_t Number of tokens
+ */
+size_t scan_count_tokens(enum scan_class cls, const char *text, size_t len) {
+    return scan_ops->split(cls, text, len, NULL);
+}
+
+/**
+ * @brief Split text into tokens in place
+ *
+ * @param cls The delimiter class
+ * @param buf The text, the delimiter ending each token is overwritten
+ * @param len Length of the text, buf[len] must be '\0'
+ * @param tokens Receives a pointer to each token
+ * @return size_t Number of tokens
+ */
+size_t scan_split(enum scan_class cls, char *buf, size_t len, char **tokens) {
+    return scan_ops->split(cls, buf, len, tokens);
+}
+
+/**
+ * @brief Skip bytes of a class
+ *
+ * @param cls The byte class
+ * @param p Start of the text
+ * @param end End of the text
+ * @return const char* First byte at or after p not in the class, or end
+ */
+const char *scan_skip(enum scan_class cls, const char *p, const char *end) {
+    return scan_ops->skip(cls, p, end);
+}
+
+/**
+ * @brief Find the next byte of a class
+ *
+ * @param cls The byte class
+ * @param p Start of the text
+ * @param end End of the text
+ * @return const char* First byte at or after p in the class, or end
+ */
+const char *scan_find(enum scan_class cls, const char *p, const char *end) {
+    return scan_ops->find(cls, p, end);
+}
+
+/**
+ * @brief Skip bytes of a class backwards
+ *
+ * @param cls The byte class
+ * @param start Start of the text
+ * @param end End of the text
+ * @return const char* One past the last byte before end not in the class,
+ * or start
+ */
+const char *scan_rskip(enum scan_class cls, const char *start, const char *end) {
+    return scan_ops->rskip(cls, start, end);
+}
@@ -0,0 +1,322 @@
+/**
+ * @file search.c
+ * @author Waylon Walsh
+ * @brief Substring search of the persistent history with a trigram index
+ * @date 2026-10-16
+ *
+ * Every entry is broken into the overlapping three byte sequences it
+ * contains and its number is appended to the posting list of each of
+ * them. An entry can only contain the pattern if it is on the posting
+ * list of every trigram of the pattern, so a search intersects those
+ * lists, smallest first, and only checks the few surviving entries with
+ * memmem. Patterns shorter than three bytes are checked against every
+ * entry. Only the newest SEARCH_MAX_CANDIDATES matches are ranked, which
+ * keeps a search for a common word as fast as one for a rare word.
+ *
+ * The index is built on the first search and then kept up to date by
+ * indexing only the entries added since the previous search, by this
+ * session or any other.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lab.h"
+
+#define TRIGRAM_TABLE_INITIAL_SIZE 4096 // Must be a power of two
+#define SEARCH_MAX_CANDIDATES 1024      // Newest matches ranked per search
+
+/**
+ * @brief Posting list of one trigram
+ */
+struct trigram_slot {
+    uint32_t key;   // Trigram plus one, 0 for an empty slot
+    uint32_t count; // Number of entries in ids
+    uint32_t size;  // Capacity of ids
+    uint32_t *ids;  // Numbers of the entries containing the trigram, ascending
+};
+
+static struct trigram_slot *trigram_table = NULL; // Open addressing table
+static size_t trigram_table_size = 0;             // Number of slots
+static size_t trigram_table_count = 0;            // Number of used slots
+static size_t indexed_entries = 0;                // Entries 1..n are indexed
+
+/**
+ * @brief Key of the trigram starting at p
+ *
+ * @param p Three bytes
+ * @return uint32_t The key, never 0
+ */
+static inline uint32_t trigram_key(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return ((uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2]) + 1;
+}
+
+/**
+ * @brief Find the slot holding key, or the empty slot where it belongs
+ *
+ * @param key The trigram key
+ * @return struct trigram_slot* The slot
+ */
+static struct trigram_slot *trigram_slot(uint32_t key) {
+    size_t mask = trigram_table_size - 1;
+    size_t i = (key * 2654435761u) & mask;
+    while (trigram_table[i].key != 0 && trigram_table[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &trigram_table[i];
+}
+
+/**
+ * @brief Double the size of the table and rehash every slot
+ *
+ * @return int 0 on success, -1 if memory could not be allocated
+ */
+static int trigram_table_grow(void) {
+    struct trigram_slot *old = trigram_table;
+    size_t old_size = trigram_table_size;
+    size_t new_size = old_size ? old_size * 2 : TRIGRAM_TABLE_INITIAL_SIZE;
+
+    struct trigram_slot *table = calloc(new_size, sizeof(struct trigram_slot));
+    if (!table) return -1;
+
+    trigram_table = table;
+    trigram_table_size = new_size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].key != 0) *trigram_slot(old[i].key) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief Add an entry to the posting lists of the trigrams in it
+ *
+ * @param n Number of the entry
+ * @param line The entry
+ * @param len Length of the entry
+ * @return int 0 on success, -1 if memory could not be allocated
+ */
+static int trigram_index_entry(uint32_t n, const char *line, size_t len) {
+    for (size_t i = 0; i + 3 <= len; i++) {
+        if (trigram_table_count * 2 >= trigram_table_size && trigram_table_grow() < 0) {
+            return -1;
+        }
+
+        uint32_t key = trigram_key(line + i);
+        struct trigram_slot *slot = trigram_slot(key);
+        if (slot->key == 0) {
+            slot->key = key;
+            trigram_table_count++;
+        }
+        // A trigram that repeats within the entry is listed once
+        if (slot->count > 0 && slot->ids[slot->count - 1] == n) continue;
+        if (slot->count == slot->size) {
+            uint32_t size = slot->size ? slot->size * 2 : 4;
+            uint32_t *ids = realloc(slot->ids, size * sizeof(uint32_t));
+            if (!ids) return -1;
+            slot->ids = ids;
+            slot->size = size;
+        }
+        slot->ids[slot->count++] = n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Index the entries added since the last search
+ */
+static void trigram_index_catch_up(void) {
+    size_t count = hist_count();
+    for (size_t n = indexed_entries + 1; n <= count; n++) {
+        size_t len;
+        const char *line = hist_get(n, &len);
+        if (line == NULL || trigram_index_entry((uint32_t)n, line, len) < 0) break;
+        indexed_entries = n;
+    }
+}
+
+/**
+ * @brief Check whether a sorted posting list contains an entry
+ *
+ * @param slot The posting list
+ * @param n The entry number
+ * @return true if n is in the list
+ */
+static bool posting_contains(const struct trigram_slot *slot, uint32_t n) {
+    size_t lo = 0, hi = slot->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (slot->ids[mid] < n) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < slot->count && slot->ids[lo] == n;
+}
+
+/**
+ * @brief Score a match, higher is better
+ *
+ * @param line The entry
+ * @param len Length of the entry
+ * @param pattern The pattern
+ * @param plen Length of the pattern
+ * @return int -1 if the entry does not contain the pattern
+ */
+static int match_score(const char *line, size_t len, const char *pattern, size_t plen) {
+    const char *hit = memmem(line, len, pattern, plen);
+    if (hit == NULL) return -1;
+    if (hit == line) return 2;    // The command starts with the pattern
+    if (hit[-1] == ' ') return 1; // The pattern starts a word
+    return 0;
+}
+
+/**
+ * @brief Order matches by score, then newest first
+ *
+ * @param a A match
+ * @param b A match
+ * @return int Comparison result for qsort
+ */
+static int match_compare(const void *a, const void *b) {
+    const struct hist_match *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    return (y->n > x->n) - (y->n < x->n);
+}
+
+/**
+ * @brief Matches of one search, with the digests of the commands found
+ */
+struct match_set {
+    struct hist_match *matches; // Matches in the order they were found
+    size_t count;               // Number of matches
+    uint64_t *digests;          // Open addressing set of command digests
+};
+
+/**
+ * @brief FNV-1a digest of a command
+ *
+ * @param line The command
+ * @param len Length of the command
+ * @return uint64_t The digest, never 0
+ */
+static uint64_t command_digest(const char *line, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)line[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+/**
+ * @brief Record a candidate if it matches
+ *
+ * @param set The matches so far
+ * @param n The entry number
+ * @param pattern The pattern
+ * @param plen Length of the pattern
+ */
+static void match_add(struct match_set *set, size_t n, const char *pattern, size_t plen) {
+    size_t len;
+    const char *line = hist_get(n, &len);
+    if (line == NULL) return;
+    int score = match_score(line, len, pattern, plen);
+    if (score < 0) return;
+
+    // Repeated commands are only shown once, as their newest entry
+    uint64_t digest = command_digest(line, len);
+    size_t mask = SEARCH_MAX_CANDIDATES * 2 - 1;
+    size_t i = digest & mask;
+    while (set->digests[i] != 0) {
+        if (set->digests[i] == digest) return;
+        i = (i + 1) & mask;
+    }
+    set->digests[i] = digest;
+
+    set->matches[set->count].n = n;
+    set->matches[set->count].score = score;
+    set->count++;
+}
+
+/**
+ * @brief Search the history for entries containing a pattern
+ *
+ * @param pattern The pattern
+ * @param matches Receives the best matches, best first
+ * @param max Size of matches
+ * @return size_t Number of matches stored
+ */
+size_t hist_search(const char *pattern, struct hist_match *matches, size_t max) {
+    size_t plen = strlen(pattern);
+    if (plen == 0 || max == 0) return 0;
+
+    trigram_index_catch_up();
+
+    struct match_set set = { 0 };
+    set.matches = malloc(SEARCH_MAX_CANDIDATES * sizeof(struct hist_match));
+    set.digests = calloc(SEARCH_MAX_CANDIDATES * 2, sizeof(uint64_t));
+    const struct trigram_slot **lists = plen >= 3 ? malloc((plen - 2) * sizeof(*lists)) : NULL;
+    if (!set.matches || !set.digests || (plen >= 3 && !lists)) {
+        free(set.matches);
+        free(set.digests);
+        free(lists);
+        return 0;
+    }
+
+    if (plen < 3) {
+        for (size_t n = indexed_entries; n > 0 && set.count < SEARCH_MAX_CANDIDATES; n--) {
+            match_add(&set, n, pattern, plen);
+        }
+    } else {
+        // The posting list of every trigram in the pattern, shortest first
+        size_t num_lists = plen - 2;
+        bool missing = trigram_table_size == 0;
+        for (size_t i = 0; i < num_lists && !missing; i++) {
+            const struct trigram_slot *slot = trigram_slot(trigram_key(pattern + i));
+            missing = slot->key == 0;
+            lists[i] = slot;
+            if (i > 0 && slot->count < lists[0]->count) {
+                lists[i] = lists[0];
+                lists[0] = slot;
+            }
+        }
+
+        // Walk the shortest list from the newest entry, probing the others
+        size_t j = missing ? 0 : lists[0]->count;
+        for (; j > 0 && set.count < SEARCH_MAX_CANDIDATES; j--) {
+            uint32_t n = lists[0]->ids[j - 1];
+            bool in_all = true;
+            for (size_t i = 1; i < num_lists && in_all; i++) {
+                in_all = posting_contains(lists[i], n);
+            }
+            if (in_all) match_add(&set, n, pattern, plen);
+        }
+    }
+
+    qsort(set.matches, set.count, sizeof(struct hist_match), match_compare);
+    size_t count = set.count < max ? set.count : max;
+    memcpy(matches, set.matches, count * sizeof(struct hist_match));
+    free(set.matches);
+    free(set.digests);
+    free(lists);
+    return count;
+}
+
+/**
+ * @brief Drop the trigram index
+ */
+void hist_search_reset(void) {
+    for (size_t i = 0; i < trigram_table_size; i++) {
+        free(trigram_table[i].ids);
+    }
+    free(trigram_table);
+    trigram_table = NULL;
+    trigram_table_size = 0;
+    trigram_table_count = 0;
+    indexed_entries = 0;
+}
@@ -0,0 +1,178 @@
+/**
+ * @file sink.c
+ * @author Waylon Walsh
+ * @brief Stream that feeds a pipe with vmsplice
+ * @date 2026-10-16
+ *
+ * When a builtin starts a pipeline it runs inside the shell and writes
+ * into the pipe through one of these streams. Output is gathered in page
+ * aligned chunks that are handed to the pipe with vmsplice, so the pipe
+ * references the pages instead of copying them. The pipe may keep using
+ * a chunk after vmsplice returns, so a chunk is never written again once
+ * it was spliced: it is unmapped (the pipe keeps its own reference) and a
+ * fresh one is mapped for the next output. Descriptors that are not pipes
+ * fall back to write.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "lab.h"
+
+#define SINK_CHUNK_SIZE (64 * 1024) // Matches the default pipe capacity
+
+/**
+ * @brief State behind a pipe sink stream
+ */
+struct pipe_sink {
+    int fd;          // Write end of the pipe
+    char *chunk;     // Chunk being filled, NULL until the first write
+    size_t used;     // Bytes of chunk in use
+    bool use_splice; // Cleared once vmsplice is known not to work on fd
+};
+
+/**
+ * @brief Write a buffer with write, retrying short writes
+ *
+ * @param fd The descriptor
+ * @param buf The data
+ * @param size Number of bytes
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int sink_write_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hand the filled part of the chunk to the pipe and retire the chunk
+ *
+ * @param sink The sink
+ * @return int 0 on success, -1 on error with errno set
+ */
+static int sink_flush(struct pipe_sink *sink) {
+    if (sink->used == 0) return 0;
+
+    int rval = 0;
+    size_t done = 0;
+    while (sink->use_splice && done < sink->used) {
+        struct iovec iov = { sink->chunk + done, sink->used - done };
+        ssize_t n = vmsplice(sink->fd, &iov, 1, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EINVAL && errno != ENOSYS && errno != EBADF) {
+                rval = -1;
+                break;
+            }
+            // Not a pipe, plain writes from here on
+            sink->use_splice = false;
+        } else {
+            done += (size_t)n;
+        }
+    }
+    size_t spliced = done;
+    if (rval == 0 && done < sink->used) {
+        rval = sink_write_all(sink->fd, sink->chunk + done, sink->used - done);
+    }
+
+    if (spliced > 0) {
+        // The pipe may still reference these pages
+        munmap(sink->chunk, SINK_CHUNK_SIZE);
+        sink->chunk = NULL;
+    }
+    sink->used = 0;
+    return rval;
+}
+
+/**
+ * @brief fopencookie write callback
+ *
+ * @param cookie The sink
+ * @param buf The data
+ * @param size Number of bytes
+ * @return ssize_t Number of bytes accepted, -1 on error
+ */
+static ssize_t sink_cookie_write(void *cookie, const char *buf, size_t size) {
+    struct pipe_sink *sink = cookie;
+    size_t done = 0;
+
+    while (done < size) {
+        if (sink->chunk == NULL) {
+            void *chunk = mmap(NULL, SINK_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk == MAP_FAILED) return done ? (ssize_t)done : -1;
+            sink->chunk = chunk;
+        }
+
+        size_t n = size - done;
+        if (n > SINK_CHUNK_SIZE - sink->used) n = SINK_CHUNK_SIZE - sink->used;
+        memcpy(sink->chunk + sink->used, buf + done, n);
+        sink->used += n;
+        done += n;
+
+        if (sink->used == SINK_CHUNK_SIZE && sink_flush(sink) < 0) {
+            return -1;
+        }
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * @brief fopencookie close callback, flushes the chunk and closes the pipe
+ *
+ * @param cookie The sink
+ * @return int 0 on success, -1 on error
+ */
+static int sink_cookie_close(void *cookie) {
+    struct pipe_sink *sink = cookie;
+    int rval = sink_flush(sink);
+
+    if (sink->chunk != NULL) munmap(sink->chunk, SINK_CHUNK_SIZE);
+    if (close(sink->fd) < 0) rval = -1;
+    free(sink);
+    return rval;
+}
+
+/**
+ * @brief Open a stream that writes into a pipe
+ *
+ * @param fd The write end of a pipe, owned by the stream from now on
+ * @return FILE* The stream, or NULL with errno set on error
+ */
+FILE *pipe_sink_open(int fd) {
+    struct pipe_sink *sink = malloc(sizeof(struct pipe_sink));
+    if (!sink) return NULL;
+    sink->fd = fd;
+    sink->chunk = NULL;
+    sink->used = 0;
+    sink->use_splice = true;
+
+    cookie_io_functions_t io = {
+        .read = NULL,
+        .write = sink_cookie_write,
+        .seek = NULL,
+        .close = sink_cookie_close,
+    };
+    FILE *out = fopencookie(sink, "w", io);
+    if (!out) {
+        free(sink);
+        return NULL;
+    }
+    // The chunk is the buffer, stdio would only add a second copy
+    setvbuf(out, NULL, _IONBF, 0);
+    return out;
+}
@@ -0,0 +1,286 @@
+/**
+ * @file spawn.c
+ * @author Waylon Walsh
+ * @brief Process creation for external commands
+ * @date 2026-10-16
+ *
+ * External commands are started with posix_spawn whenever the child only
+ * needs setup that spawn attributes can express (process group, terminal
+ * hand-off, signal dispositions). glibc implements posix_spawn with
+ * clone(CLONE_VM|CLONE_VFORK), so the shell's page tables are never
+ * copied. A classic fork + exec path is kept for anything else.
+ *
+ * Command names are resolved through the path hash table (hash.c) so the
+ * PATH walk only happens the first time a command is used. A cached path
+ * whose file went away is forgotten and resolved again in either mode. As
+ * with execvp, a file that is executable but not a binary or a #! script
+ * is run by /bin/sh.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lab.h"
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+
+extern char **environ;
+
+static enum spawn_mode spawn_mode = SPAWN_AUTO;
+
+// Signals the shell ignores that must be back to default in the child
+static const int child_default_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU,
+};
+
+#define NUM_DEFAULT_SIGNALS (sizeof(child_default_signals) / sizeof(child_default_signals[0]))
+
+#define SCRIPT_SHELL "/bin/sh" // Runs executable files the kernel cannot
+
+/**
+ * @brief Select how external commands are started
+ *
+ * @param mode The spawn strategy
+ */
+void set_spawn_mode(enum spawn_mode mode) {
+    spawn_mode = mode;
+}
+
+/**
+ * @brief Check whether posix_spawn can do all of the child setup
+ *
+ * @param opts The requested child setup
+ * @return true if posix_spawn can be used
+ */
+static bool spawn_can_use_posix(const struct spawn_opts *opts) {
+    if (spawn_mode == SPAWN_FORK) return false;
+#ifndef HAVE_SPAWN_TCSETPGRP
+    if (opts->terminal >= 0) return false;
+#else
+    UNUSED(opts)
+#endif
+    return true;
+}
+
+/**
+ * @brief Number of entries the arguments of a script need
+ *
+ * @param argv Arguments for the new program
+ * @return size_t Length of the script's argument vector with its NULL
+ */
+static size_t script_argc(char **argv) {
+    size_t n = 0;
+    while (argv[n] != NULL) n++;
+    return n + 2;
+}
+
+/**
+ * @brief Build the arguments that run a file without #! through the shell
+ *
+ * @param out Receives script_argc(argv) entries
+ * @param path Path of the file
+ * @param argv Arguments for the new program
+ */
+static void script_argv(char **out, const char *path, char **argv) {
+    out[0] = SCRIPT_SHELL;
+    out[1] = (char *)path;
+    for (size_t i = 1; argv[i - 1] != NULL; i++) {
+        out[i + 1] = argv[i];
+    }
+}
+
+/**
+ * @brief Start a child with fork and execv
+ *
+ * If the exec fails the child reports errno through a close-on-exec pipe,
+ * so the caller gets the same error as from posix_spawn.
+ *
+ * @param path Resolved path of the program
+ * @param argv Arguments for the new program
+ * @param opts Child setup
+ * @return pid_t Pid of the child or -1 on error with errno set
+ */
+static pid_t spawn_fork(const char *path, char **argv, const struct spawn_opts *opts) {
+    int errpipe[2];
+    if (pipe2(errpipe, O_CLOEXEC) < 0) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        int saved = errno;
+        close(errpipe[0]);
+        close(errpipe[1]);
+        errno = saved;
+        return -1;
+    }
+    if (pid > 0) {
+        close(errpipe[1]);
+        int err;
+        ssize_t n;
+        while ((n = read(errpipe[0], &err, sizeof(err))) < 0 && errno == EINTR) continue;
+        close(errpipe[0]);
+        if (n != (ssize_t)sizeof(err)) return pid;
+
+        // The exec failed, the child is gone already
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) continue;
+        errno = err;
+        return -1;
+    }
+
+    // Child process
+    close(errpipe[0]);
+    if (opts->pgid >= 0) {
+        setpgid(0, opts->pgid);
+    }
+    if (opts->terminal >= 0) {
+        tcsetpgrp(opts->terminal, getpgrp());
+    }
+    for (size_t i = 0; i < opts->num_actions; i++) {
+        const struct spawn_action *action = &opts->actions[i];
+        if (action->src_fd == action->fd) {
+            // dup2 onto itself would leave close-on-exec set
+            if (fcntl(action->fd, F_SETFD, 0) < 0) {
+                perror("shell");
+                _exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        if (dup2(action->src_fd, action->fd) < 0) {
+            perror("shell");
+            _exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t i = 0; i < NUM_DEFAULT_SIGNALS; i++) {
+        signal(child_default_signals[i], SIG_DFL);
+    }
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    execv(path, argv);
+    if (errno == ENOEXEC) {
+        char *script[script_argc(argv)];
+        script_argv(script, path, argv);
+        execv(SCRIPT_SHELL, script);
+        errno = ENOEXEC;
+    }
+    int err = errno;
+    ssize_t written = write(errpipe[1], &err, sizeof(err));
+    UNUSED(written)
+    _exit(127);
+}
+
+/**
+ * @brief Start a child with posix_spawn
+ *
+ * @param path Resolved path of the program
+ * @param argv Arguments for the new program
+ * @param opts Child setup
+ * @return pid_t Pid of the child or -1 on error with errno set
+ */
+static pid_t spawn_posix(const char *path, char **argv, const struct spawn_opts *opts) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t defaults, mask;
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    pid_t pid = -1;
+
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < NUM_DEFAULT_SIGNALS; i++) {
+        sigaddset(&defaults, child_default_signals[i]);
+    }
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+    if (opts->pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, opts->pgid);
+    }
+#ifdef HAVE_SPAWN_TCSETPGRP
+    if (opts->terminal >= 0) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, opts->terminal);
+    }
+#endif
+    for (size_t i = 0; i < opts->num_actions; i++) {
+        const struct spawn_action *action = &opts->actions[i];
+        posix_spawn_file_actions_adddup2(&actions, action->src_fd, action->fd);
+    }
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    int rval = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rval != 0) {
+        errno = rval;
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * @brief Start a child with the strategy the setup allows
+ *
+ * @param path Resolved path of the program
+ * @param argv Arguments for the new program
+ * @param opts Child setup
+ * @return pid_t Pid of the child or -1 on error with errno set
+ */
+static pid_t spawn_path(const char *path, char **argv, const struct spawn_opts *opts) {
+    if (!spawn_can_use_posix(opts)) {
+        return spawn_fork(path, argv, opts);
+    }
+
+    pid_t pid = spawn_posix(path, argv, opts);
+    if (pid < 0 && errno == ENOEXEC) {
+        char *script[script_argc(argv)];
+        script_argv(script, path, argv);
+        pid = spawn_posix(SCRIPT_SHELL, script, opts);
+        if (pid < 0) errno = ENOEXEC;
+    }
+    return pid;
+}
+
+/**
+ * @brief Start an external command
+ *
+ * @param argv Arguments for the new program, argv[0] is looked up in PATH
+ * @param opts Child setup
+ * @return pid_t Pid of the child or -1 on error with errno set
+ */
+pid_t spawn_command(char **argv, const struct spawn_opts *opts) {
+    if (argv == NULL || argv[0] == NULL || opts == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bool hashed = strchr(argv[0], '/') == NULL;
+    const char *path = hashed ? path_hash_lookup(argv[0]) : argv[0];
+    if (path == NULL) return -1;
+
+    pid_t pid = spawn_path(path, argv, opts);
+    if (pid < 0 && errno == ENOENT && hashed) {
+        // The cached file was removed or renamed, resolve it again
+        path_hash_forget(argv[0]);
+        path = path_hash_lookup(argv[0]);
+        if (path == NULL) return -1;
+        pid = spawn_path(path, argv, opts);
+    }
+    return pid;
+}
@@ -0,0 +1,222 @@
+/**
+ * @file stats.c
+ * @author Waylon Walsh
+ * @brief Counters and latency histograms of the shell's hot paths
+ * @date 2026-10-16
+ *
+ * The main loop, cmd_parse, do_builtin, execute_command and
+ * update_job_status are wrapped in STATS_MEASURE. While stats_enabled is
+ * false that costs one branch the compiler is told is not taken, so the
+ * instrumentation stays in release builds. Once enabled, by shstats on or
+ * the -S option, every call reads the monotonic clock twice and adds the
+ * latency to the histogram of its point.
+ *
+ * Histograms use HDR-style log buckets: values below 16 ns get a bucket
+ * each, above that every power of two is split into 16 buckets, so any
+ * value is known to within 1/16 of itself. Values of 2^37 ns, about two
+ * minutes, and more land in the last bucket. The histograms are thread
+ * local and updated without locks or atomics. shstats reports the ones of
+ * the thread that runs it, which is the thread that runs commands.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "lab.h"
+
+#define STATS_SUB_BITS 4                    // log2 of buckets per power of two
+#define STATS_SUB (1u << STATS_SUB_BITS)    // Buckets per power of two
+#define STATS_MAX_EXP 36                    // Largest power of two with buckets
+#define STATS_BUCKETS ((STATS_MAX_EXP - STATS_SUB_BITS + 2) * STATS_SUB)
+
+/**
+ * @brief Latency histogram of one instrumented point
+ */
+struct stats_hist {
+    uint64_t count;                   // Calls recorded
+    uint64_t total_ns;                // Sum of their latencies
+    uint64_t min_ns;                  // Smallest latency, 0 before any call
+    uint64_t max_ns;                  // Largest latency
+    uint64_t buckets[STATS_BUCKETS];  // Calls per latency bucket
+};
+
+bool stats_enabled = false;
+
+static _Thread_local struct stats_hist stats[NUM_STAT_POINTS];
+
+static const char *const stats_names[NUM_STAT_POINTS] = {
+    "line", "parse", "builtin", "execute", "jobs",
+};
+
+/**
+ * @brief Bucket of a latency
+ *
+ * @param ns The latency
+ * @return unsigned Index into buckets
+ */
+static unsigned stats_bucket(uint64_t ns) {
+    if (ns < STATS_SUB) return (unsigned)ns;
+    unsigned exp = 63u - (unsigned)__builtin_clzll(ns);
+    if (exp > STATS_MAX_EXP) return STATS_BUCKETS - 1;
+    unsigned shift = exp - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB + (unsigned)(ns >> shift) - STATS_SUB;
+}
+
+/**
+ * @brief Largest latency that falls in a bucket
+ *
+ * @param bucket Index into buckets
+ * @return uint64_t The latency
+ */
+static uint64_t stats_bucket_max(unsigned bucket) {
+    if (bucket < STATS_SUB) return bucket;
+    unsigned shift = bucket / STATS_SUB - 1;
+    uint64_t low = (uint64_t)(STATS_SUB + bucket % STATS_SUB) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+/**
+ * @brief Record one call of an instrumented point
+ *
+ * @param point The point
+ * @param ns How long the call took
+ */
+void stats_record(enum stat_point point, uint64_t ns) {
+    struct stats_hist *h = &stats[point];
+    if (h->count == 0 || ns < h->min_ns) h->min_ns = ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+    h->count++;
+    h->total_ns += ns;
+    h->buckets[stats_bucket(ns)]++;
+}
+
+/**
+ * @brief Forget everything recorded by this thread
+ */
+void stats_reset(void) {
+    memset(stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Number of calls recorded for a point
+ *
+ * @param point The point
+ * @return uint64_t The count
+ */
+uint64_t stats_count(enum stat_point point) {
+    return stats[point].count;
+}
+
+/**
+ * @brief Latency below which a fraction of the calls of a point fell
+ *
+ * @param point The point
+ * @param q The fraction, between 0 and 1
+ * @return uint64_t The latency in nanoseconds, rounded up to the end of
+ * its bucket but never above the largest one seen, 0 without calls
+ */
+uint64_t stats_quantile(enum stat_point point, double q) {
+    const struct stats_hist *h = &stats[point];
+    if (h->count == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)h->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->count) rank = h->count;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < STATS_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t ns = stats_bucket_max(b);
+            return ns < h->max_ns ? ns : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+/**
+ * @brief Print the stats as a table
+ *
+ * @param out Stream to print to
+ */
+static void stats_print_table(FILE *out) {
+    fprintf(out, "stats %s\n", stats_enabled ? "on" : "off");
+    fprintf(out, "%-8s %10s %12s %10s %10s %10s %10s %10s\n", "point", "count",
+            "total_us", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+    for (int p = 0; p < NUM_STAT_POINTS; p++) {
+        const struct stats_hist *h = &stats[p];
+        double mean = h->count ? (double)h->total_ns / (double)h->count : 0;
+        fprintf(out, "%-8s %10llu %12.1f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                stats_names[p], (unsigned long long)h->count, (double)h->total_ns / 1e3,
+                mean / 1e3, (double)stats_quantile(p, 0.5) / 1e3,
+                (double)stats_quantile(p, 0.9) / 1e3, (double)stats_quantile(p, 0.99) / 1e3,
+                (double)h->max_ns / 1e3);
+    }
+}
+
+/**
+ * @brief Print the stats as JSON
+ *
+ * Every point has its count, total, min, max and quantiles in
+ * nanoseconds, and the non-empty buckets as [largest value, count] pairs.
+ *
+ * @param out Stream to print to
+ */
+static void stats_print_json(FILE *out) {
+    fprintf(out, "{\"enabled\":%s,\"points\":{", stats_enabled ? "true" : "false");
+    for (int p = 0; p < NUM_STAT_POINTS; p++) {
+        const struct stats_hist *h = &stats[p];
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"min_ns\":%llu,"
+                "\"max_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,"
+                "\"p999_ns\":%llu,\"buckets\":[",
+                p ? "," : "", stats_names[p], (unsigned long long)h->count,
+                (unsigned long long)h->total_ns, (unsigned long long)h->min_ns,
+                (unsigned long long)h->max_ns,
+                (unsigned long long)stats_quantile(p, 0.5),
+                (unsigned long long)stats_quantile(p, 0.9),
+                (unsigned long long)stats_quantile(p, 0.99),
+                (unsigned long long)stats_quantile(p, 0.999));
+        bool first = true;
+        for (unsigned b = 0; b < STATS_BUCKETS; b++) {
+            if (h->buckets[b] == 0) continue;
+            fprintf(out, "%s[%llu,%llu]", first ? "" : ",",
+                    (unsigned long long)stats_bucket_max(b), (unsigned long long)h->buckets[b]);
+            first = false;
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "}}\n");
+}
+
+/**
+ * @brief Run the shstats builtin
+ *
+ * shstats prints a table of the points, shstats -j the same as JSON.
+ * shstats on and shstats off start and stop recording, shstats reset
+ * forgets what was recorded.
+ *
+ * @param sh Pointer to the shell structure
+ * @param argv Array of command arguments
+ * @param out Stream the builtin writes to
+ * @return int 0 on success, 1 on a usage error
+ */
+int builtin_shstats(struct shell *sh, char **argv, FILE *out) {
+    UNUSED(sh)
+    const char *arg = argv[1];
+    if (arg != NULL && argv[2] != NULL) arg = "";
+
+    if (arg == NULL) {
+        stats_print_table(out);
+    } else if (strcmp(arg, "-j") == 0) {
+        stats_print_json(out);
+    } else if (strcmp(arg, "on") == 0) {
+        stats_enabled = true;
+    } else if (strcmp(arg, "off") == 0) {
+        stats_enabled = false;
+    } else if (strcmp(arg, "reset") == 0) {
+        stats_reset();
+    } else {
+        fprintf(stderr, "shstats: usage: shstats [-j | on | off | reset]\n");
+        return 1;
+    }
+    return 0;
+}
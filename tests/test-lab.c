@@ -1,4 +1,13 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <time.h>
 #include <string.h>
+#include <errno.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
 
@@ -53,6 +62,676 @@ void test_cmd_parse(void)
      cmd_free(rval);
 }
 
+void test_cmd_parse_many_args(void)
+{
+     //More arguments than fit in any fixed initial allocation
+     char line[4096] = "echo";
+     for (int i = 0; i < 500; i++) {
+          strcat(line, " a");
+     }
+     char **rval = cmd_parse(line);
+     TEST_ASSERT_EQUAL_STRING("echo", rval[0]);
+     for (int i = 1; i <= 500; i++) {
+          TEST_ASSERT_EQUAL_STRING("a", rval[i]);
+     }
+     TEST_ASSERT_NULL(rval[501]);
+     cmd_free(rval);
+}
+
+void test_cmd_parse_mixed_delims(void)
+{
+     char **rval = cmd_parse(" \tls\t-a \r\n");
+     TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+     TEST_ASSERT_EQUAL_STRING("-a", rval[1]);
+     TEST_ASSERT_NULL(rval[2]);
+     cmd_free(rval);
+
+     rval = cmd_parse("   ");
+     TEST_ASSERT_NULL(rval[0]);
+     cmd_free(rval);
+}
+
+void test_cmd_parse_arena(void)
+{
+     struct arena a;
+     arena_init(&a);
+     char **rval = cmd_parse_arena(&a, "ls -a -l");
+     TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+     TEST_ASSERT_EQUAL_STRING("-l", rval[2]);
+     TEST_ASSERT_NULL(rval[3]);
+     //After a reset the same memory is handed out again
+     arena_reset(&a);
+     char **again = cmd_parse_arena(&a, "pwd");
+     TEST_ASSERT_EQUAL_PTR(rval, again);
+     TEST_ASSERT_EQUAL_STRING("pwd", again[0]);
+     //Requests larger than a chunk still work
+     char *big = arena_alloc(&a, 1024 * 1024);
+     memset(big, 'x', 1024 * 1024);
+     TEST_ASSERT_EQUAL_STRING("pwd", again[0]);
+     arena_destroy(&a);
+}
+
+void test_arena_reset_trims(void)
+{
+     struct arena a = {0};
+     char *first = arena_alloc(&a, 100);
+     size_t small = arena_reserved(&a);
+     TEST_ASSERT_TRUE(small >= 100);
+
+     //One huge line must not keep its memory for the rest of the session
+     for (int i = 0; i < 64; i++) arena_alloc(&a, 256 * 1024);
+     arena_alloc(&a, 32 * 1024 * 1024);
+     TEST_ASSERT_TRUE(arena_reserved(&a) > 48 * 1024 * 1024);
+     arena_reset(&a);
+     TEST_ASSERT_EQUAL_size_t(small, arena_reserved(&a));
+     TEST_ASSERT_EQUAL_PTR(first, arena_alloc(&a, 100));
+
+     //Many small allocations keep a few chunks, not all of them
+     for (int i = 0; i < 100000; i++) arena_alloc(&a, 64);
+     arena_reset(&a);
+     TEST_ASSERT_TRUE(arena_reserved(&a) >= small);
+     TEST_ASSERT_TRUE(arena_reserved(&a) <= 4 * small);
+     arena_destroy(&a);
+     TEST_ASSERT_EQUAL_size_t(0, arena_reserved(&a));
+}
+
+void test_cmd_parse_operators(void)
+{
+     char **rval = cmd_parse("ls -l|wc -l&");
+     TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+     TEST_ASSERT_EQUAL_STRING("-l", rval[1]);
+     TEST_ASSERT_EQUAL_STRING("|", rval[2]);
+     TEST_ASSERT_EQUAL_STRING("wc", rval[3]);
+     TEST_ASSERT_EQUAL_STRING("-l", rval[4]);
+     TEST_ASSERT_EQUAL_STRING("&", rval[5]);
+     TEST_ASSERT_NULL(rval[6]);
+     cmd_free(rval);
+}
+
+void test_cmd_parse_redirects(void)
+{
+     char **rval = cmd_parse("sort<in a2>out 2>&1 >>log cat<<<word");
+     const char *expect[] = { "sort", "<", "in", "a2", ">", "out", "2>&", "1",
+                              ">>", "log", "cat", "<<<", "word", NULL };
+     for (int i = 0; expect[i] != NULL; i++) {
+          TEST_ASSERT_EQUAL_STRING(expect[i], rval[i]);
+     }
+     TEST_ASSERT_NULL(rval[13]);
+     cmd_free(rval);
+}
+
+void test_pipeline_parse_redirects(void)
+{
+     struct arena a = {0};
+     struct pipeline *pl = pipeline_parse(&a, cmd_parse_arena(&a, "sort -r < in > out 2>&1 | wc"));
+     TEST_ASSERT_NOT_NULL(pl);
+     struct command *cmd = &pl->commands[0];
+     TEST_ASSERT_EQUAL_STRING("sort", cmd->argv[0]);
+     TEST_ASSERT_EQUAL_STRING("-r", cmd->argv[1]);
+     TEST_ASSERT_NULL(cmd->argv[2]);
+     TEST_ASSERT_EQUAL_UINT(3, cmd->num_redirs);
+     TEST_ASSERT_EQUAL_INT(REDIRECT_IN, cmd->redirs[0].type);
+     TEST_ASSERT_EQUAL_INT(0, cmd->redirs[0].fd);
+     TEST_ASSERT_EQUAL_STRING("in", cmd->redirs[0].target);
+     TEST_ASSERT_EQUAL_INT(REDIRECT_OUT, cmd->redirs[1].type);
+     TEST_ASSERT_EQUAL_INT(1, cmd->redirs[1].fd);
+     TEST_ASSERT_EQUAL_INT(REDIRECT_DUP, cmd->redirs[2].type);
+     TEST_ASSERT_EQUAL_INT(2, cmd->redirs[2].fd);
+     TEST_ASSERT_EQUAL_STRING("1", cmd->redirs[2].target);
+     TEST_ASSERT_EQUAL_UINT(0, pl->commands[1].num_redirs);
+
+     TEST_ASSERT_NULL(pipeline_parse(&a, cmd_parse_arena(&a, "ls >")));
+     TEST_ASSERT_NULL(pipeline_parse(&a, cmd_parse_arena(&a, "ls > | wc")));
+     arena_destroy(&a);
+}
+
+static char *read_file(const char *path)
+{
+     static char buf[4096];
+     FILE *f = fopen(path, "r");
+     TEST_ASSERT_NOT_NULL(f);
+     size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+     buf[n] = '\0';
+     fclose(f);
+     return buf;
+}
+
+void test_execute_redirects(void)
+{
+     struct shell sh = {0};
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char line[256], out[128];
+     snprintf(out, sizeof(out), "%s/out", dir);
+
+     snprintf(line, sizeof(line), "echo one > %s", out);
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, line), &sh));
+     snprintf(line, sizeof(line), "cat <<< two >> %s", out);
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, line), &sh));
+     TEST_ASSERT_EQUAL_STRING("one\ntwo\n", read_file(out));
+
+     //Order matters, stderr follows stdout into the file
+     snprintf(line, sizeof(line), "ls %s/missing > %s 2>&1", dir, out);
+     TEST_ASSERT_NOT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, line), &sh));
+     TEST_ASSERT_NOT_NULL(strstr(read_file(out), "missing"));
+
+     //Builtins are redirected inside the shell
+     snprintf(line, sizeof(line), "pwd > %s", out);
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, line), &sh));
+     char cwd[1024];
+     TEST_ASSERT_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+     strcat(cwd, "\n");
+     TEST_ASSERT_EQUAL_STRING(cwd, read_file(out));
+
+     //A missing input file is reported and the command does not run
+     snprintf(line, sizeof(line), "cat < %s/missing", dir);
+     TEST_ASSERT_EQUAL_INT(1, execute_command(cmd_parse_arena(&sh.arena, line), &sh));
+
+     unlink(out);
+     rmdir(dir);
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+}
+
+void test_cmd_parse_view(void)
+{
+     struct arena a = {0};
+     //Only the first line is parsed and the buffer is left alone
+     const char *buf = "ls -a>out\nwc -l";
+     char **rval = cmd_parse_view(&a, buf, 9);
+     TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+     TEST_ASSERT_EQUAL_STRING("-a", rval[1]);
+     TEST_ASSERT_EQUAL_STRING(">", rval[2]);
+     TEST_ASSERT_EQUAL_STRING("out", rval[3]);
+     TEST_ASSERT_NULL(rval[4]);
+     rval = cmd_parse_view(&a, buf + 10, 2);
+     TEST_ASSERT_EQUAL_STRING("wc", rval[0]);
+     TEST_ASSERT_NULL(rval[1]);
+     arena_destroy(&a);
+}
+
+void test_line_reader(void)
+{
+     FILE *f = tmpfile();
+     TEST_ASSERT_NOT_NULL(f);
+     //A line longer than the initial buffer and a last line without newline
+     size_t long_len = 3 * 1024 * 1024;
+     fputs("first\n\n", f);
+     for (size_t i = 0; i < long_len; i++) fputc('x', f);
+     fputs("\nlast", f);
+     fflush(f);
+     rewind(f);
+
+     struct line_reader r;
+     TEST_ASSERT_EQUAL_INT(0, line_reader_init(&r, fileno(f)));
+     TEST_ASSERT_EQUAL_STRING("first", line_reader_next(&r));
+     TEST_ASSERT_EQUAL_STRING("", line_reader_next(&r));
+     char *line = line_reader_next(&r);
+     TEST_ASSERT_NOT_NULL(line);
+     TEST_ASSERT_EQUAL_size_t(long_len, strlen(line));
+     TEST_ASSERT_EQUAL_STRING("last", line_reader_next(&r));
+     TEST_ASSERT_NULL(line_reader_next(&r));
+     line_reader_destroy(&r);
+     fclose(f);
+}
+
+void test_sh_run_string(void)
+{
+     struct shell sh = {0};
+     sh.batch = true;
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char commands[512], out[128];
+     snprintf(out, sizeof(out), "%s/out", dir);
+     snprintf(commands, sizeof(commands),
+              "echo one > %s\n\n   \necho two >> %s\nfalse", out, out);
+     //The status is the status of the last command
+     TEST_ASSERT_EQUAL_INT(1, sh_run_string(&sh, commands));
+     TEST_ASSERT_EQUAL_STRING("one\ntwo\n", read_file(out));
+
+     //A script file runs the same way
+     snprintf(commands, sizeof(commands), "%s/script", dir);
+     FILE *f = fopen(commands, "w");
+     fprintf(f, "echo three > %s\ntrue\n", out);
+     fclose(f);
+     TEST_ASSERT_EQUAL_INT(0, sh_run_script(&sh, commands));
+     TEST_ASSERT_EQUAL_STRING("three\n", read_file(out));
+     TEST_ASSERT_EQUAL_INT(127, sh_run_script(&sh, "/no/such/script"));
+
+     //On standard input the script is shared with the commands, cat gets
+     //the lines after its own and the shell does not run them
+     f = fopen(commands, "w");
+     fprintf(f, "cat > %s\nfrom script\nfalse\n", out);
+     fclose(f);
+     int fd = open(commands, O_RDONLY);
+     TEST_ASSERT_TRUE(fd >= 0);
+     int saved = dup(STDIN_FILENO);
+     dup2(fd, STDIN_FILENO);
+     close(fd);
+     int status = sh_run_script(&sh, NULL);
+     dup2(saved, STDIN_FILENO);
+     close(saved);
+     TEST_ASSERT_EQUAL_INT(0, status);
+     TEST_ASSERT_EQUAL_STRING("from script\nfalse\n", read_file(out));
+
+     unlink(commands);
+     unlink(out);
+     rmdir(dir);
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+}
+
+void test_builtin_ls(void)
+{
+     struct shell sh = {0};
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char path[128], out[128];
+     const char *names[] = {"b", "a", ".hidden", "ab", "B", "a0"};
+     for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+          snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+          close(open(path, O_WRONLY | O_CREAT, 0644));
+          chmod(path, 0644);
+     }
+     snprintf(out, sizeof(out), "%s.out", dir);
+
+     //Names are sorted bytewise, dot files only show with -a
+     char *plain[] = {"ls", dir, NULL};
+     FILE *f = fopen(out, "w");
+     TEST_ASSERT_EQUAL_INT(0, builtin_ls(&sh, plain, f));
+     fclose(f);
+     TEST_ASSERT_EQUAL_STRING("B\na\na0\nab\nb\n", read_file(out));
+
+     char *all[] = {"ls", "-a", dir, NULL};
+     f = fopen(out, "w");
+     TEST_ASSERT_EQUAL_INT(0, builtin_ls(&sh, all, f));
+     fclose(f);
+     TEST_ASSERT_EQUAL_STRING(".\n..\n.hidden\nB\na\na0\nab\nb\n", read_file(out));
+
+     //Long format starts with the block total, one line per entry
+     char *lng[] = {"ls", "-l", dir, NULL};
+     f = fopen(out, "w");
+     TEST_ASSERT_EQUAL_INT(0, builtin_ls(&sh, lng, f));
+     fclose(f);
+     char *text = read_file(out);
+     TEST_ASSERT_EQUAL_STRING_LEN("total 0\n-rw-r--r-- 1 ", text, 21);
+     TEST_ASSERT_NOT_NULL(strstr(text, " B\n"));
+     TEST_ASSERT_NULL(strstr(text, ".hidden"));
+
+     char *missing[] = {"ls", "/nonexistent-test-lab", NULL};
+     f = fopen(out, "w");
+     TEST_ASSERT_EQUAL_INT(1, builtin_ls(&sh, missing, f));
+     fclose(f);
+
+     for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+          snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+          unlink(path);
+     }
+     unlink(out);
+     rmdir(dir);
+}
+
+void test_builtin_ls_long_order(void)
+{
+     struct shell sh = {0};
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char path[128];
+     //Enough entries to fetch their status on several threads
+     for (int i = 0; i < 500; i++) {
+          snprintf(path, sizeof(path), "%s/f%03d", dir, (i * 7) % 500);
+          close(open(path, O_WRONLY | O_CREAT, 0644));
+     }
+
+     char *lng[] = {"ls", "-l", dir, NULL};
+     char *text = NULL;
+     size_t size = 0;
+     FILE *f = open_memstream(&text, &size);
+     TEST_ASSERT_EQUAL_INT(0, builtin_ls(&sh, lng, f));
+     fclose(f);
+
+     //Every line is in name order, whichever thread examined it
+     char *line = strchr(text, '\n') + 1;
+     for (int i = 0; i < 500; i++) {
+          char *nl = strchr(line, '\n');
+          TEST_ASSERT_NOT_NULL(nl);
+          char want[8];
+          snprintf(want, sizeof(want), "f%03d", i);
+          TEST_ASSERT_EQUAL_STRING_LEN(want, nl - 4, 4);
+          line = nl + 1;
+     }
+     TEST_ASSERT_EQUAL_CHAR('\0', *line);
+     free(text);
+
+     for (int i = 0; i < 500; i++) {
+          snprintf(path, sizeof(path), "%s/f%03d", dir, i);
+          unlink(path);
+     }
+     rmdir(dir);
+}
+
+static void loop_count_input(int fd, void *arg)
+{
+     char buf[16];
+     if (read(fd, buf, sizeof(buf)) > 0) (*(int *)arg)++;
+}
+
+static void loop_count_timer(void *arg)
+{
+     (*(int *)arg)++;
+}
+
+static void check_event_loop(enum loop_backend want)
+{
+     if (loop_init(want) < 0) {
+          //io_uring may be disabled, epoll must work
+          TEST_ASSERT_EQUAL_INT(LOOP_URING, want);
+          return;
+     }
+     TEST_ASSERT_EQUAL_INT(want, loop_backend());
+
+     int fds[2];
+     TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+     int reads = 0, fired = 0, cancelled = 0;
+     TEST_ASSERT_EQUAL_INT(0, loop_watch(fds[0], loop_count_input, &reads));
+     TEST_ASSERT_EQUAL_INT(-1, loop_watch(fds[0], loop_count_input, &reads));
+
+     //Input is reported each time it arrives
+     for (int i = 1; i <= 3; i++) {
+          TEST_ASSERT_EQUAL_INT(1, write(fds[1], "x", 1));
+          while (reads < i) TEST_ASSERT_TRUE(loop_run_once() >= 0);
+     }
+
+     //Timers fire in order, a cancelled one never does
+     int late = loop_timer_add(200, loop_count_timer, &cancelled);
+     TEST_ASSERT_TRUE(loop_timer_add(20, loop_count_timer, &fired) > 0);
+     TEST_ASSERT_TRUE(late > 0);
+     while (fired == 0) TEST_ASSERT_TRUE(loop_run_once() >= 0);
+     loop_timer_cancel(late);
+
+     //Nothing is reported for a descriptor that is no longer watched
+     loop_unwatch(fds[0]);
+     TEST_ASSERT_EQUAL_INT(1, write(fds[1], "x", 1));
+     TEST_ASSERT_TRUE(loop_timer_add(50, loop_count_timer, &fired) > 0);
+     while (fired == 1) TEST_ASSERT_TRUE(loop_run_once() >= 0);
+     TEST_ASSERT_EQUAL_INT(3, reads);
+     TEST_ASSERT_EQUAL_INT(0, cancelled);
+
+     loop_destroy();
+     TEST_ASSERT_EQUAL_INT(LOOP_NONE, loop_backend());
+     close(fds[0]);
+     close(fds[1]);
+}
+
+void test_event_loop(void)
+{
+     check_event_loop(LOOP_URING);
+     check_event_loop(LOOP_EPOLL);
+}
+
+void test_hist_store(void)
+{
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char path[128], idx[128];
+     snprintf(path, sizeof(path), "%s/history", dir);
+     snprintf(idx, sizeof(idx), "%s/history.idx", dir);
+
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+     TEST_ASSERT_EQUAL_size_t(0, hist_count());
+     TEST_ASSERT_EQUAL_INT(0, hist_add("ls -l", NULL));
+     TEST_ASSERT_EQUAL_INT(0, hist_add("echo hi", NULL));
+     TEST_ASSERT_EQUAL_size_t(2, hist_count());
+
+     size_t len;
+     const char *entry = hist_get(2, &len);
+     TEST_ASSERT_NOT_NULL(entry);
+     TEST_ASSERT_EQUAL_size_t(7, len);
+     TEST_ASSERT_EQUAL_MEMORY("echo hi", entry, len);
+     TEST_ASSERT_NULL(hist_get(3, &len));
+     TEST_ASSERT_NULL(hist_get(0, &len));
+
+     char *line = hist_expand("!1");
+     TEST_ASSERT_EQUAL_STRING("ls -l", line);
+     free(line);
+     TEST_ASSERT_NULL(hist_expand("!3"));
+
+     //Sessions appending at the same time each get their own entries. Each
+     //session opens the files itself, a forked copy would share the lock
+     signal(SIGCHLD, SIG_DFL);
+     for (int c = 0; c < 4; c++) {
+          if (fork() == 0) {
+               hist_open(path);
+               for (int i = 0; i < 100; i++) hist_add("child", NULL);
+               _exit(0);
+          }
+     }
+     while (wait(NULL) > 0);
+     TEST_ASSERT_EQUAL_size_t(402, hist_count());
+     for (size_t n = 3; n <= 402; n++) {
+          entry = hist_get(n, &len);
+          TEST_ASSERT_NOT_NULL(entry);
+          TEST_ASSERT_EQUAL_MEMORY("child", entry, 5);
+          TEST_ASSERT_EQUAL_size_t(5, len);
+     }
+
+     //Lines a crashed session left without index entries are indexed
+     int fd = open(path, O_WRONLY | O_APPEND);
+     TEST_ASSERT_TRUE(write(fd, "lost\nhalf", 9) == 9);
+     close(fd);
+     TEST_ASSERT_EQUAL_INT(0, hist_add("after", NULL));
+     TEST_ASSERT_EQUAL_size_t(405, hist_count());
+     entry = hist_get(404, &len);
+     TEST_ASSERT_EQUAL_size_t(4, len);
+     TEST_ASSERT_EQUAL_MEMORY("half", entry, len);
+     entry = hist_get(405, &len);
+     TEST_ASSERT_EQUAL_size_t(5, len);
+     TEST_ASSERT_EQUAL_MEMORY("after", entry, len);
+
+     hist_close();
+     unlink(path);
+     unlink(idx);
+     rmdir(dir);
+}
+
+void test_hist_search(void)
+{
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char path[128], idx[128];
+     snprintf(path, sizeof(path), "%s/history", dir);
+     snprintf(idx, sizeof(idx), "%s/history.idx", dir);
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+
+     hist_add("git status", NULL);
+     hist_add("make check", NULL);
+     hist_add("echo git", NULL);
+     hist_add("legit thing", NULL);
+     hist_add("git status", NULL);
+
+     //Starts with the pattern, then word starts, then the rest, newest first
+     struct hist_match m[8];
+     TEST_ASSERT_EQUAL_size_t(3, hist_search("git", m, 8));
+     TEST_ASSERT_EQUAL_size_t(5, m[0].n);
+     TEST_ASSERT_EQUAL_INT(2, m[0].score);
+     TEST_ASSERT_EQUAL_size_t(3, m[1].n);
+     TEST_ASSERT_EQUAL_size_t(4, m[2].n);
+     TEST_ASSERT_EQUAL_size_t(1, hist_search("git", m, 1));
+     TEST_ASSERT_EQUAL_size_t(0, hist_search("gitx", m, 8));
+
+     //Short patterns and entries added after the index was built
+     TEST_ASSERT_EQUAL_size_t(1, hist_search("ma", m, 8));
+     hist_add("make clean", NULL);
+     TEST_ASSERT_EQUAL_size_t(2, hist_search("make c", m, 8));
+     TEST_ASSERT_EQUAL_size_t(6, m[0].n);
+
+     hist_close();
+     unlink(path);
+     unlink(idx);
+     rmdir(dir);
+}
+
+static void collect_ring(uint64_t seq, const char *line, void *arg)
+{
+     char *buf = arg;
+     sprintf(buf + strlen(buf), "%llu:%s ", (unsigned long long)seq, line);
+}
+
+void test_hist_ring(void)
+{
+     char buf[256] = "";
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(3, HIST_DEDUP_NONE));
+     TEST_ASSERT_EQUAL_INT(1, hist_ring_add("a", 0));
+     TEST_ASSERT_EQUAL_INT(1, hist_ring_add("a", 0));
+     TEST_ASSERT_EQUAL_INT(1, hist_ring_add("b", 0));
+     TEST_ASSERT_EQUAL_INT(1, hist_ring_add("c", 0));
+     hist_ring_foreach(collect_ring, buf);
+     TEST_ASSERT_EQUAL_STRING("2:a 3:b 4:c ", buf);
+
+     // Only a repeat of the newest entry is dropped
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(3, HIST_DEDUP_CONSECUTIVE));
+     TEST_ASSERT_EQUAL_INT(1, hist_ring_add("a", 10));
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_add("a", 11));
+     TEST_ASSERT_EQUAL_INT(1, hist_ring_add("b", 12));
+     TEST_ASSERT_EQUAL_INT(1, hist_ring_add("a", 13));
+     buf[0] = '\0';
+     hist_ring_foreach(collect_ring, buf);
+     TEST_ASSERT_EQUAL_STRING("10:a 12:b 13:a ", buf);
+
+     // Older copies are erased, the hole is reused when the ring wraps
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(3, HIST_DEDUP_ALL));
+     hist_ring_add("a", 0);
+     hist_ring_add("b", 0);
+     hist_ring_add("a", 0);
+     buf[0] = '\0';
+     hist_ring_foreach(collect_ring, buf);
+     TEST_ASSERT_EQUAL_STRING("2:b 3:a ", buf);
+     hist_ring_add("c", 0);
+     hist_ring_add("b", 0);
+     buf[0] = '\0';
+     hist_ring_foreach(collect_ring, buf);
+     TEST_ASSERT_EQUAL_STRING("3:a 4:c 5:b ", buf);
+
+     // Lines that fell out of the ring are no longer duplicates
+     for (int i = 0; i < 100; i++) {
+          char line[16];
+          sprintf(line, "x%d", i % 5);
+          hist_ring_add(line, 0);
+     }
+     buf[0] = '\0';
+     hist_ring_foreach(collect_ring, buf);
+     TEST_ASSERT_EQUAL_STRING("103:x2 104:x3 105:x4 ", buf);
+
+     hist_ring_destroy();
+     TEST_ASSERT_EQUAL_size_t(0, hist_ring_capacity());
+     TEST_ASSERT_EQUAL_INT(-1, hist_ring_add("a", 0));
+}
+
+void test_pipeline_parse(void)
+{
+     struct arena a = {0};
+     char **argv = cmd_parse_arena(&a, "cat foo | grep -v bar | wc &");
+     struct pipeline *pl = pipeline_parse(&a, argv);
+     TEST_ASSERT_NOT_NULL(pl);
+     TEST_ASSERT_EQUAL_UINT(3, pl->count);
+     TEST_ASSERT_TRUE(pl->background);
+     TEST_ASSERT_EQUAL_STRING("foo", pl->commands[0].argv[1]);
+     TEST_ASSERT_NULL(pl->commands[0].argv[2]);
+     TEST_ASSERT_EQUAL_STRING("-v", pl->commands[1].argv[1]);
+     TEST_ASSERT_EQUAL_STRING("wc", pl->commands[2].argv[0]);
+     TEST_ASSERT_NULL(pl->commands[2].argv[1]);
+
+     TEST_ASSERT_NULL(pipeline_parse(&a, cmd_parse_arena(&a, "ls |")));
+     TEST_ASSERT_NULL(pipeline_parse(&a, cmd_parse_arena(&a, "ls | | wc")));
+     TEST_ASSERT_NULL(pipeline_parse(&a, cmd_parse_arena(&a, "ls & wc")));
+     arena_destroy(&a);
+}
+
+void test_execute_pipeline_status(void)
+{
+     struct shell sh = {0};
+     //The status of a pipeline is the status of its last stage
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "false | true"), &sh));
+     TEST_ASSERT_EQUAL_INT(1, execute_command(cmd_parse_arena(&sh.arena, "true | false"), &sh));
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "seq 1000 | grep -q 999"), &sh));
+     //A last stage that cannot be started decides the status as well
+     TEST_ASSERT_EQUAL_INT(127, execute_command(cmd_parse_arena(&sh.arena, "true | no-such-command-here"), &sh));
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "no-such-command-here | true"), &sh));
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+}
+
+void test_builtin_lookup(void)
+{
+     const char *names[] = {"exit", "cd", "history", "pwd", "ls", "jobs", "hash", "parallel", "time", "shstats"};
+     for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+          const struct builtin *b = builtin_lookup(names[i]);
+          TEST_ASSERT_NOT_NULL(b);
+          TEST_ASSERT_EQUAL_STRING(names[i], b->name);
+     }
+     //Every entry of the table gets a slot of its own
+     size_t count;
+     const struct builtin *table = builtin_table(&count);
+     for (size_t i = 0; i < count; i++) {
+          TEST_ASSERT_EQUAL_PTR(&table[i], builtin_lookup(table[i].name));
+     }
+     TEST_ASSERT_NULL(builtin_lookup("cat"));
+     TEST_ASSERT_NULL(builtin_lookup(""));
+     TEST_ASSERT_NULL(builtin_lookup("exi"));
+     TEST_ASSERT_NULL(builtin_lookup("exit2"));
+     TEST_ASSERT_TRUE(builtin_lookup("cd")->flags & BUILTIN_SHELL);
+     TEST_ASSERT_FALSE(builtin_lookup("pwd")->flags & BUILTIN_SHELL);
+
+     char *ls[] = {"ls", NULL};
+     char *ls_l[] = {"ls", "-la", "/tmp", NULL};
+     char *ls_r[] = {"ls", "-R", NULL};
+     char *cat[] = {"cat", NULL};
+     TEST_ASSERT_TRUE(is_builtin(ls));
+     TEST_ASSERT_TRUE(is_builtin(ls_l));
+     TEST_ASSERT_FALSE(is_builtin(ls_r));
+     TEST_ASSERT_FALSE(is_builtin(cat));
+}
+
+void test_execute_builtin_producer(void)
+{
+     struct shell sh = {0};
+     //A builtin in the first stage feeds the pipe from inside the shell
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "pwd | grep -q /"), &sh));
+     TEST_ASSERT_EQUAL_INT(1, execute_command(cmd_parse_arena(&sh.arena, "hash | grep -q /no/such/command"), &sh));
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+}
+
+void test_pipe_sink_large_output(void)
+{
+     int fds[2];
+     TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+     //Room for everything so the test can write before it reads
+     TEST_ASSERT_TRUE(fcntl(fds[1], F_SETPIPE_SZ, 1024 * 1024) >= 200000);
+
+     FILE *out = pipe_sink_open(fds[1]);
+     TEST_ASSERT_NOT_NULL(out);
+     for (int i = 0; i < 20000; i++) {
+          fprintf(out, "%09d\n", i);
+     }
+     TEST_ASSERT_EQUAL_INT(0, fclose(out));
+
+     char *buf = malloc(200001);
+     size_t len = 0;
+     ssize_t n;
+     while ((n = read(fds[0], buf + len, 200001 - len)) > 0) {
+          len += (size_t)n;
+     }
+     close(fds[0]);
+     TEST_ASSERT_EQUAL_size_t(200000, len);
+     for (int i = 0; i < 20000; i += 997) {
+          char expect[11];
+          snprintf(expect, sizeof(expect), "%09d\n", i);
+          TEST_ASSERT_EQUAL_MEMORY(expect, buf + i * 10, 10);
+     }
+     free(buf);
+}
+
 void test_trim_white_no_whitespace(void)
 {
      char *line = (char*) calloc(10, sizeof(char));
@@ -116,6 +795,37 @@ void test_trim_white_mostly_whitespace(void)
      free(line);
 }
 
+void test_scan_impls_agree(void)
+{
+     //Long enough to exercise the vector loops and their scalar tails
+     char line[200];
+     memset(line, ' ', sizeof(line));
+     memcpy(line + 3, "a\tb\vc\ad", 7);
+     memcpy(line + 150, "e", 1);
+     const char *end = line + sizeof(line);
+     const enum scan_impl impls[] = { SCAN_IMPL_SCALAR, SCAN_IMPL_SSE2, SCAN_IMPL_AVX2 };
+     for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+          if (scan_set_impl(impls[i]) != 0) continue;
+          TEST_ASSERT_EQUAL_PTR(line + 3, scan_skip(SCAN_SPACE, line, end));
+          TEST_ASSERT_EQUAL_PTR(line + 4, scan_find(SCAN_SPACE, line + 3, end));
+          TEST_ASSERT_EQUAL_PTR(line + 10, scan_find(SCAN_SPACE, line + 7, end));
+          TEST_ASSERT_EQUAL_PTR(line + 8, scan_find(SCAN_ARG_DELIMS, line + 5, end));
+          TEST_ASSERT_EQUAL_UINT(4, scan_count_tokens(SCAN_ARG_DELIMS, line, sizeof(line)));
+          TEST_ASSERT_EQUAL_UINT(4, scan_count_tokens(SCAN_SPACE, line, sizeof(line)));
+          char copy[sizeof(line) + 1];
+          char *tokens[4];
+          memcpy(copy, line, sizeof(line));
+          copy[sizeof(line)] = '\0';
+          TEST_ASSERT_EQUAL_UINT(4, scan_split(SCAN_ARG_DELIMS, copy, sizeof(line), tokens));
+          TEST_ASSERT_EQUAL_STRING("b\vc", tokens[1]);
+          TEST_ASSERT_EQUAL_STRING("e", tokens[3]);
+          TEST_ASSERT_EQUAL_PTR(line + 150, scan_skip(SCAN_SPACE, line + 11, end));
+          TEST_ASSERT_EQUAL_PTR(line + 151, scan_rskip(SCAN_SPACE, line, end));
+          TEST_ASSERT_EQUAL_PTR(line, scan_rskip(SCAN_SPACE, line, line + 3));
+     }
+     scan_set_impl(SCAN_IMPL_AUTO);
+}
+
 void test_get_prompt_default(void)
 {
      char *prompt = get_prompt("MY_PROMPT");
@@ -163,20 +873,519 @@ void test_ch_dir_root(void)
      cmd_free(cmd);
 }
 
+static void check_spawn_command(enum spawn_mode mode)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     TEST_ASSERT_TRUE(fd >= 0);
+
+     //The child writes to the file through the dup2 action and exits with 3
+     char *argv[] = {"sh", "-c", "echo spawned; exit 3", NULL};
+     struct spawn_action action = { STDOUT_FILENO, fd };
+     struct spawn_opts opts = { .pgid = -1, .terminal = -1, .actions = &action, .num_actions = 1 };
+     set_spawn_mode(mode);
+     pid_t pid = spawn_command(argv, &opts);
+     close(fd);
+     TEST_ASSERT_TRUE(pid > 0);
+     int status;
+     TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+     TEST_ASSERT_TRUE(WIFEXITED(status));
+     TEST_ASSERT_EQUAL_INT(3, WEXITSTATUS(status));
+     TEST_ASSERT_EQUAL_STRING("spawned\n", read_file(path));
+
+     //A command that does not exist fails in the shell, not in a child
+     char *missing[] = {"no-such-command-here", NULL};
+     TEST_ASSERT_EQUAL_INT(-1, spawn_command(missing, &opts));
+
+     //An executable file without #! is run by /bin/sh, even after the
+     //cached path to it went stale
+     char dir[] = "/tmp/test-lab-XXXXXX", old_script[128], new_script[128];
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     snprintf(old_script, sizeof(old_script), "%s/a", dir);
+     snprintf(new_script, sizeof(new_script), "%s/b", dir);
+     TEST_ASSERT_EQUAL_INT(0, mkdir(old_script, 0755));
+     TEST_ASSERT_EQUAL_INT(0, mkdir(new_script, 0755));
+     strcat(old_script, "/lab-script");
+     strcat(new_script, "/lab-script");
+     FILE *f = fopen(old_script, "w");
+     TEST_ASSERT_NOT_NULL(f);
+     fputs("exit 5\n", f);
+     fclose(f);
+     TEST_ASSERT_EQUAL_INT(0, chmod(old_script, 0755));
+
+     char *old_path = strdup(getenv("PATH"));
+     char env[300];
+     snprintf(env, sizeof(env), "%s/a:%s/b", dir, dir);
+     setenv("PATH", env, true);
+     char *script[] = {"lab-script", NULL};
+     opts.num_actions = 0;
+     for (int i = 0; i < 2; i++) {
+          pid = spawn_command(script, &opts);
+          TEST_ASSERT_TRUE(pid > 0);
+          TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+          TEST_ASSERT_TRUE(WIFEXITED(status));
+          TEST_ASSERT_EQUAL_INT(5, WEXITSTATUS(status));
+          //Move the script along PATH behind the cache's back
+          if (i == 0) TEST_ASSERT_EQUAL_INT(0, rename(old_script, new_script));
+     }
+     TEST_ASSERT_EQUAL_STRING(new_script, path_hash_lookup("lab-script"));
+
+     setenv("PATH", old_path, true);
+     free(old_path);
+     path_hash_clear();
+     unlink(new_script);
+     *strrchr(new_script, '/') = '\0';
+     *strrchr(old_script, '/') = '\0';
+     rmdir(new_script);
+     rmdir(old_script);
+     rmdir(dir);
+     set_spawn_mode(SPAWN_AUTO);
+     unlink(path);
+}
+
+void test_spawn_command(void)
+{
+     check_spawn_command(SPAWN_AUTO);
+     check_spawn_command(SPAWN_FORK);
+}
+
+void test_path_hash_lookup(void)
+{
+     char *old_path = strdup(getenv("PATH"));
+     setenv("PATH", "/nonexistent:/bin", true);
+     TEST_ASSERT_EQUAL_STRING("/bin/sh", path_hash_lookup("sh"));
+     TEST_ASSERT_NULL(path_hash_lookup("no-such-command-here"));
+     //Changing PATH must flush the old entries
+     setenv("PATH", "/usr/bin", true);
+     TEST_ASSERT_EQUAL_STRING("/usr/bin/sh", path_hash_lookup("sh"));
+     path_hash_forget("sh");
+     TEST_ASSERT_EQUAL_STRING("/usr/bin/sh", path_hash_lookup("sh"));
+
+     //Commands found through an empty PATH element are not cached
+     char dir[] = "/tmp/test-lab-XXXXXX", cmd[128];
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     snprintf(cmd, sizeof(cmd), "%s/lab-cmd", dir);
+     int fd = open(cmd, O_WRONLY | O_CREAT, 0755);
+     TEST_ASSERT_TRUE(fd >= 0);
+     close(fd);
+     char *old_cwd = getcwd(NULL, 0);
+     TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+     setenv("PATH", ":/bin", true);
+     path_hash_clear();
+     TEST_ASSERT_EQUAL_STRING("./lab-cmd", path_hash_lookup("lab-cmd"));
+     TEST_ASSERT_EQUAL_INT(0, chdir("/"));
+     TEST_ASSERT_NULL(path_hash_lookup("lab-cmd"));
+     TEST_ASSERT_EQUAL_INT(0, chdir(old_cwd));
+     free(old_cwd);
+     unlink(cmd);
+     rmdir(dir);
+
+     setenv("PATH", old_path, true);
+     free(old_path);
+     path_hash_clear();
+}
+
+void test_job_table_grows(void)
+{
+     //Well past the old fixed limit of 100 jobs
+     int first = add_job(900000, "sleep 1 &", true);
+     TEST_ASSERT_GREATER_THAN(0, first);
+     for (int i = 1; i < 1000; i++) {
+          TEST_ASSERT_EQUAL_INT(first + i, add_job(900000 + i, "sleep 1 &", true));
+     }
+     for (int i = 0; i < 1000; i += 2) {
+          remove_job(first + i);
+     }
+     //Freed slots are reused and ids keep increasing
+     TEST_ASSERT_EQUAL_INT(first + 1000, add_job(901000, "a much longer command line than before &", true));
+     destroy_jobs();
+}
+
+void test_jobs_notify_fd(void)
+{
+     struct shell sh = {0};
+     initialize_jobs();
+     int fd = jobs_notify_fd();
+     TEST_ASSERT_TRUE(fd >= 0);
+     TEST_ASSERT_FALSE(jobs_reaped_pending());
+
+     //The descriptor becomes readable once the background job exits
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "true &"), &sh));
+     struct pollfd pfd = { .fd = fd, .events = POLLIN };
+     int ready;
+     while ((ready = poll(&pfd, 1, 5000)) < 0 && errno == EINTR) continue;
+     TEST_ASSERT_EQUAL_INT(1, ready);
+     TEST_ASSERT_TRUE(jobs_reaped_pending());
+
+     char *buf = NULL;
+     size_t len = 0;
+     FILE *out = open_memstream(&buf, &len);
+     TEST_ASSERT_NOT_NULL(out);
+     print_jobs(out);
+     fclose(out);
+     TEST_ASSERT_NOT_NULL(strstr(buf, "Done"));
+     TEST_ASSERT_FALSE(jobs_reaped_pending());
+     free(buf);
+
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+     signal(SIGCHLD, SIG_DFL);
+}
+
+//Run update_job_status with stdout sent to a file and count the Done
+//notifications it printed
+static int count_done_notifications(void)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     TEST_ASSERT_TRUE(fd >= 0);
+     fflush(stdout);
+     int saved = dup(STDOUT_FILENO);
+     dup2(fd, STDOUT_FILENO);
+     update_job_status();
+     fflush(stdout);
+     dup2(saved, STDOUT_FILENO);
+     close(saved);
+     close(fd);
+
+     int count = 0;
+     FILE *f = fopen(path, "r");
+     char line[256];
+     while (fgets(line, sizeof(line), f) != NULL) {
+          if (strstr(line, "] Done ") != NULL) count++;
+     }
+     fclose(f);
+     unlink(path);
+     return count;
+}
+
+void test_sigchld_reaping(void)
+{
+     struct shell sh = { .batch = true };
+     set_reap_mode(REAP_SIGCHLD);
+     initialize_jobs();
+     struct sigaction sa;
+     sigaction(SIGCHLD, NULL, &sa);
+     TEST_ASSERT_TRUE(sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN);
+
+     //A background job is reported done exactly once
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "true &"), &sh));
+     int done = 0;
+     for (int i = 0; i < 500 && done == 0; i++) {
+          usleep(10000);
+          done += count_done_notifications();
+     }
+     TEST_ASSERT_EQUAL_INT(1, done);
+     TEST_ASSERT_EQUAL_INT(0, count_done_notifications());
+
+     //The handler leaves the status of a foreground child to its waiter,
+     //even while background children exit around it
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "sleep 0.05 &"), &sh));
+     char *exit7[] = {"sh", "-c", "sleep 0.1; exit 7", NULL};
+     TEST_ASSERT_EQUAL_INT(7, execute_command(exit7, &sh));
+     TEST_ASSERT_EQUAL_INT(1, execute_command(cmd_parse_arena(&sh.arena, "false"), &sh));
+     TEST_ASSERT_EQUAL_INT(1, count_done_notifications());
+
+     //More children than the handler's ring holds are all reported once
+     for (int i = 0; i < 300; i++) {
+          TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "true &"), &sh));
+          arena_reset(&sh.arena);
+     }
+     done = 0;
+     for (int i = 0; i < 500 && done < 300; i++) {
+          usleep(10000);
+          done += count_done_notifications();
+     }
+     TEST_ASSERT_EQUAL_INT(300, done);
+     TEST_ASSERT_EQUAL_INT(0, count_done_notifications());
+
+     arena_destroy(&sh.arena);
+     set_reap_mode(REAP_AUTO);
+     initialize_jobs();
+     destroy_jobs();
+}
+
+void test_builtin_parallel(void)
+{
+     struct shell sh = {0};
+     initialize_jobs();
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char target[128], path[128];
+     snprintf(target, sizeof(target), "%s/f{}", dir);
+
+     //Every input runs once with {} replaced by it
+     int status = -1;
+     char *touch[] = {"parallel", "-j", "2", "touch", target, ":::", "a", "b", "c", NULL};
+     TEST_ASSERT_TRUE(builtin_run(&sh, touch, stdout, &status));
+     TEST_ASSERT_EQUAL_INT(0, status);
+     const char *names[] = {"fa", "fb", "fc"};
+     for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+          snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+          TEST_ASSERT_EQUAL_INT(0, access(path, F_OK));
+          unlink(path);
+     }
+     rmdir(dir);
+
+     //The status is the number of jobs that failed
+     char *test[] = {"parallel", "-j3", "test", "0", "=", ":::", "0", "3", "0", "1", NULL};
+     TEST_ASSERT_TRUE(builtin_run(&sh, test, stdout, &status));
+     TEST_ASSERT_EQUAL_INT(2, status);
+
+     //No more than -j jobs run at once
+     struct timespec start, end;
+     clock_gettime(CLOCK_MONOTONIC, &start);
+     char *sleeps[] = {"parallel", "-j", "2", "sleep", ":::", "0.2", "0.2", "0.2", "0.2", NULL};
+     TEST_ASSERT_TRUE(builtin_run(&sh, sleeps, stdout, &status));
+     clock_gettime(CLOCK_MONOTONIC, &end);
+     TEST_ASSERT_EQUAL_INT(0, status);
+     double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+     TEST_ASSERT_TRUE(elapsed >= 0.39);
+
+     char *usage[] = {"parallel", "-j", "0", "true", ":::", "x", NULL};
+     TEST_ASSERT_TRUE(builtin_run(&sh, usage, stdout, &status));
+     TEST_ASSERT_EQUAL_INT(255, status);
+
+     //Finished jobs leave the table
+     char *buf = NULL;
+     size_t len = 0;
+     FILE *out = open_memstream(&buf, &len);
+     print_jobs(out);
+     fclose(out);
+     TEST_ASSERT_EQUAL_size_t(0, len);
+     free(buf);
+
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+}
+
+void test_job_usage(void)
+{
+     struct shell sh = {0};
+     initialize_jobs();
+
+     //A foreground job leaves its usage behind
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "seq 1000000 > /dev/null"), &sh));
+     struct job_usage usage;
+     job_last_usage(&usage);
+     double real = (double)(usage.finished.tv_sec - usage.started.tv_sec) +
+                   (double)(usage.finished.tv_nsec - usage.started.tv_nsec) / 1e9;
+     double cpu = (double)(usage.rusage.ru_utime.tv_sec + usage.rusage.ru_stime.tv_sec) +
+                  (double)(usage.rusage.ru_utime.tv_usec + usage.rusage.ru_stime.tv_usec) / 1e6;
+     TEST_ASSERT_TRUE(real > 0);
+     TEST_ASSERT_TRUE(cpu > 0);
+     TEST_ASSERT_TRUE(usage.rusage.ru_maxrss > 0);
+
+     //jobs -l lists what a background job used, once it is done
+     TEST_ASSERT_EQUAL_INT(0, execute_command(cmd_parse_arena(&sh.arena, "true &"), &sh));
+     struct pollfd pfd = { .fd = jobs_notify_fd(), .events = POLLIN };
+     int ready;
+     while ((ready = poll(&pfd, 1, 5000)) < 0 && errno == EINTR) continue;
+     TEST_ASSERT_EQUAL_INT(1, ready);
+
+     char *buf = NULL;
+     size_t len = 0;
+     FILE *out = open_memstream(&buf, &len);
+     print_jobs_long(out);
+     fclose(out);
+     TEST_ASSERT_NOT_NULL(strstr(buf, "Done true & (real "));
+     TEST_ASSERT_NOT_NULL(strstr(buf, "\n    real "));
+     TEST_ASSERT_NOT_NULL(strstr(buf, " faults "));
+     TEST_ASSERT_NOT_NULL(strstr(buf, " ctxsw "));
+     free(buf);
+
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+}
+
+void test_builtin_time(void)
+{
+     struct shell sh = {0};
+     initialize_jobs();
+     char line[] = "time seq 1000 | grep -q 999";
+     TEST_ASSERT_EQUAL_INT(0, sh_eval(&sh, line));
+     TEST_ASSERT_TRUE(phase_total_ns(PHASE_PARSE) > 0);
+     TEST_ASSERT_TRUE(phase_total_ns(PHASE_SPAWN) > 0);
+     TEST_ASSERT_TRUE(phase_total_ns(PHASE_RUN) > 0);
+
+     //The status is the one of the timed command
+     char failing[] = "time false";
+     TEST_ASSERT_EQUAL_INT(1, sh_eval(&sh, failing));
+
+     //A sleep is all run time, not shell overhead
+     char sleeping[] = "time sleep 0.1";
+     TEST_ASSERT_EQUAL_INT(0, sh_eval(&sh, sleeping));
+     TEST_ASSERT_TRUE(phase_total_ns(PHASE_RUN) >= 100000000u);
+     TEST_ASSERT_TRUE(phase_total_ns(PHASE_SPAWN) < 100000000u);
+
+     arena_destroy(&sh.arena);
+     destroy_jobs();
+}
+
+void test_builtin_time_own_usage(void)
+{
+     struct shell sh = { .batch = true };
+     set_reap_mode(REAP_SIGCHLD);
+     initialize_jobs();
+
+     //A background job reaped while time waits is not charged to it
+     char busy[] = "seq 30000000 > /dev/null &";
+     TEST_ASSERT_EQUAL_INT(0, sh_eval(&sh, busy));
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     TEST_ASSERT_TRUE(fd >= 0);
+     fflush(stderr);
+     int saved = dup(STDERR_FILENO);
+     dup2(fd, STDERR_FILENO);
+     char timed[] = "time sleep 1";
+     int status = sh_eval(&sh, timed);
+     dup2(saved, STDERR_FILENO);
+     close(saved);
+     close(fd);
+     TEST_ASSERT_EQUAL_INT(0, status);
+
+     //The busy job really did finish during the sleep
+     char *buf = NULL;
+     size_t len = 0;
+     FILE *out = open_memstream(&buf, &len);
+     print_jobs(out);
+     fclose(out);
+     TEST_ASSERT_NOT_NULL(strstr(buf, "Done seq"));
+     free(buf);
+
+     double user = -1, sys = -1;
+     const char *report = read_file(path);
+     const char *u = strstr(report, "user\t");
+     const char *s = strstr(report, "sys\t");
+     TEST_ASSERT_NOT_NULL(u);
+     TEST_ASSERT_NOT_NULL(s);
+     sscanf(u, "user\t%lfs", &user);
+     sscanf(s, "sys\t%lfs", &sys);
+     TEST_ASSERT_TRUE(user >= 0 && sys >= 0);
+     TEST_ASSERT_TRUE(user + sys < 0.1);
+     unlink(path);
+
+     //The jobs parallel starts for the timed line are charged to it
+     char script[] = "/tmp/test-lab-XXXXXX";
+     int sfd = mkstemp(script);
+     TEST_ASSERT_TRUE(sfd >= 0);
+     const char *body = "seq 30000000 > /dev/null\n";
+     TEST_ASSERT_EQUAL_INT((int)strlen(body), (int)write(sfd, body, strlen(body)));
+     close(sfd);
+     char line[128];
+     snprintf(line, sizeof(line), "time parallel -j2 sh ::: %s %s", script, script);
+     strcpy(path, "/tmp/test-lab-XXXXXX");
+     fd = mkstemp(path);
+     TEST_ASSERT_TRUE(fd >= 0);
+     fflush(stderr);
+     saved = dup(STDERR_FILENO);
+     dup2(fd, STDERR_FILENO);
+     status = sh_eval(&sh, line);
+     dup2(saved, STDERR_FILENO);
+     close(saved);
+     close(fd);
+     TEST_ASSERT_EQUAL_INT(0, status);
+     report = read_file(path);
+     u = strstr(report, "user\t");
+     s = strstr(report, "sys\t");
+     TEST_ASSERT_NOT_NULL(u);
+     TEST_ASSERT_NOT_NULL(s);
+     sscanf(u, "user\t%lfs", &user);
+     sscanf(s, "sys\t%lfs", &sys);
+     TEST_ASSERT_TRUE(user + sys > 0.1);
+     unlink(path);
+     unlink(script);
+
+     arena_destroy(&sh.arena);
+     set_reap_mode(REAP_AUTO);
+     initialize_jobs();
+     destroy_jobs();
+}
+
+void test_shstats(void)
+{
+     struct arena a = {0};
+     stats_reset();
+
+     //Nothing is recorded until stats are enabled
+     cmd_parse_arena(&a, "ls -l");
+     TEST_ASSERT_EQUAL_UINT64(0, stats_count(STAT_PARSE));
+
+     stats_enabled = true;
+     for (int i = 0; i < 100; i++) cmd_parse_arena(&a, "ls -l /tmp | wc -l");
+     TEST_ASSERT_EQUAL_UINT64(100, stats_count(STAT_PARSE));
+     uint64_t p50 = stats_quantile(STAT_PARSE, 0.5);
+     TEST_ASSERT_TRUE(p50 > 0);
+     TEST_ASSERT_TRUE(p50 <= stats_quantile(STAT_PARSE, 0.99));
+
+     char *buf = NULL;
+     size_t len = 0;
+     FILE *out = open_memstream(&buf, &len);
+     char *json[] = {"shstats", "-j", NULL};
+     TEST_ASSERT_EQUAL_INT(0, builtin_shstats(NULL, json, out));
+     fclose(out);
+     TEST_ASSERT_EQUAL_STRING_LEN("{\"enabled\":true,", buf, 16);
+     TEST_ASSERT_NOT_NULL(strstr(buf, "\"parse\":{\"count\":100,"));
+     free(buf);
+
+     char *off[] = {"shstats", "off", NULL};
+     TEST_ASSERT_EQUAL_INT(0, builtin_shstats(NULL, off, stdout));
+     TEST_ASSERT_FALSE(stats_enabled);
+     cmd_parse_arena(&a, "ls");
+     TEST_ASSERT_EQUAL_UINT64(100, stats_count(STAT_PARSE));
+
+     stats_reset();
+     TEST_ASSERT_EQUAL_UINT64(0, stats_count(STAT_PARSE));
+     arena_destroy(&a);
+}
+
 int main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_cmd_parse);
   RUN_TEST(test_cmd_parse2);
+  RUN_TEST(test_cmd_parse_many_args);
+  RUN_TEST(test_cmd_parse_mixed_delims);
+  RUN_TEST(test_cmd_parse_arena);
+  RUN_TEST(test_arena_reset_trims);
+  RUN_TEST(test_cmd_parse_operators);
+  RUN_TEST(test_pipeline_parse);
+  RUN_TEST(test_cmd_parse_redirects);
+  RUN_TEST(test_pipeline_parse_redirects);
+  RUN_TEST(test_execute_redirects);
+  RUN_TEST(test_cmd_parse_view);
+  RUN_TEST(test_line_reader);
+  RUN_TEST(test_sh_run_string);
+  RUN_TEST(test_builtin_ls);
+  RUN_TEST(test_builtin_ls_long_order);
+  RUN_TEST(test_event_loop);
+  RUN_TEST(test_hist_store);
+  RUN_TEST(test_hist_search);
+  RUN_TEST(test_hist_ring);
+  RUN_TEST(test_execute_pipeline_status);
+  RUN_TEST(test_builtin_lookup);
+  RUN_TEST(test_execute_builtin_producer);
+  RUN_TEST(test_pipe_sink_large_output);
   RUN_TEST(test_trim_white_no_whitespace);
   RUN_TEST(test_trim_white_start_whitespace);
   RUN_TEST(test_trim_white_end_whitespace);
   RUN_TEST(test_trim_white_both_whitespace_single);
   RUN_TEST(test_trim_white_both_whitespace_double);
   RUN_TEST(test_trim_white_all_whitespace);
+  RUN_TEST(test_scan_impls_agree);
   RUN_TEST(test_get_prompt_default);
   RUN_TEST(test_get_prompt_custom);
   RUN_TEST(test_ch_dir_home);
   RUN_TEST(test_ch_dir_root);
+  RUN_TEST(test_spawn_command);
+  RUN_TEST(test_path_hash_lookup);
+  RUN_TEST(test_job_table_grows);
+  RUN_TEST(test_jobs_notify_fd);
+  RUN_TEST(test_sigchld_reaping);
+  RUN_TEST(test_builtin_parallel);
+  RUN_TEST(test_job_usage);
+  RUN_TEST(test_builtin_time);
+  RUN_TEST(test_builtin_time_own_usage);
+  RUN_TEST(test_shstats);
 
   return UNITY_END();
 }
\ No newline at end of file